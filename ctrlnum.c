@@ -0,0 +1,62 @@
+/**
+ *  ctrlnum.c
+ */
+#include "ctrlnum.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/**
+    returns the control number k places after last, wrapping around from
+    CONTROL_NUMBER_MAX to 1
+*/
+static long advance(long last, long k) {
+    return (last + k - 1) % CONTROL_NUMBER_MAX + 1;
+}
+
+int reserve_control_numbers(const char *path, int count, long *first) {
+
+    char buffer[CONTROL_NUMBER_LEN + 2] = {0};
+    int fd;
+    int rc = -1;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0666)) < 0)
+        return -1;
+
+    // the lock is held only while the counter is read and advanced
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    char *end = buffer;
+    long last = (n > 0) ? strtol(buffer, &end, 10) : 0;
+
+    // an empty counter file starts the range at the default control number
+    if (n == 0)
+        last = atol(DEFAULT_CONTROL_NUMBER) - 1;
+
+    if ((n >= 0) && (n == 0 || end != buffer) && last >= 0 && last <= CONTROL_NUMBER_MAX && count > 0) {
+        int len = snprintf(buffer, sizeof(buffer), "%0*ld\n", CONTROL_NUMBER_LEN, advance(last, count));
+
+        if ((pwrite(fd, buffer, (size_t) len, 0) == len) && (ftruncate(fd, len) == 0)) {
+            *first = advance(last, 1);
+            rc = 0;
+        }
+    }
+
+    flock(fd, LOCK_UN);
+    if (close(fd) != 0)
+        rc = -1;
+    return rc;
+}
+
+void format_control_number(char *dst, long first, int n) {
+    sprintf(dst, "%0*ld", CONTROL_NUMBER_LEN, advance(first, n));
+}
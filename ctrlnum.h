@@ -0,0 +1,40 @@
+/**
+    @file ctrlnum.h
+    Together with ctrlnum.c, this component hands out the 7-digit control
+    numbers that identify each IDoc. The last number used is kept in a
+    small counter file, which is locked with flock() while a run reserves
+    a range of numbers for all of its IDoc files at once. Parallel runs
+    sharing the counter file therefore never number two IDocs alike, and
+    the threads of one run never take a lock per file.
+*/
+
+#ifndef STOIDOC_CTRLNUM_H
+#define STOIDOC_CTRLNUM_H
+
+/* the control number every IDoc carries when no counter file is given    */
+#define DEFAULT_CONTROL_NUMBER "2541435"
+
+/* the number of digits in a control number, and the largest one         */
+#define CONTROL_NUMBER_LEN     7
+#define CONTROL_NUMBER_MAX     9999999L
+
+/**
+    reserves a range of consecutive control numbers from a counter file,
+    creating the file if it does not exist. Numbers run from 1 to
+    CONTROL_NUMBER_MAX and then wrap around to 1.
+    @param path is the counter file, which holds the last number reserved
+    @param count is the number of control numbers to reserve
+    @param first receives the first number of the range
+    @return 0 if successful, -1 if unsuccessful
+*/
+int reserve_control_numbers(const char *path, int count, long *first);
+
+/**
+    formats the nth number of a reserved range as a control number
+    @param dst receives the control number; it must hold CONTROL_NUMBER_LEN + 1 chars
+    @param first is the first number of the range
+    @param n is the position in the range, starting at 0
+*/
+void format_control_number(char *dst, long first, int n);
+
+#endif //STOIDOC_CTRLNUM_H
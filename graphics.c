@@ -0,0 +1,325 @@
+/**
+ *  graphics.c
+ */
+#include "graphics.h"
+#include "labelhash.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* the first line of a snapshot names its version and the folder scanned  */
+#define GRAPHICS_MAGIC        "stoidoc-graphics 1"
+
+/* the longest graphic path looked up                                    */
+#define GRAPHIC_NAME_MAX      4096
+
+/** a directory of the graphics folder and its modification time         */
+typedef struct {
+    char *path;
+    long long mtime_sec;
+    long mtime_nsec;
+} Dir_stamp;
+
+/** the directories a scan visited                                       */
+typedef struct {
+    Dir_stamp *dirs;
+    int count;
+} Dir_list;
+
+/**
+    case-folds a path and turns its '\' separators into '/', in place
+*/
+static void fold_path(char *path) {
+
+    for (char *cp = path; *cp; cp++)
+        *cp = (*cp == '\\') ? '/' : (char) tolower((unsigned char) *cp);
+}
+
+static bool path_used(const void *entry) {
+    return *(char *const *) entry != NULL;
+}
+
+static bool path_matches(const void *entry, const void *key) {
+    return strcmp(*(char *const *) entry, (const char *) key) == 0;
+}
+
+static uint64_t path_hash(const void *entry) {
+    return fnv1a_string(*(char *const *) entry);
+}
+
+static const Hash_ops path_ops = {sizeof(char *), path_used, path_matches, path_hash};
+
+/**
+    returns the slot of a path: its entry, or the empty slot it belongs in
+*/
+static char **find_slot(const Graphics_set *set, const char *path) {
+    return (char **) hash_table_slot(&path_ops, set->paths, set->cap, fnv1a_string(path), path);
+}
+
+static int init_set(Graphics_set *set, size_t cap) {
+
+    set->cap = cap;
+    set->count = 0;
+    set->paths = (char **) calloc(cap, sizeof(char *));
+    return set->paths == NULL ? -1 : 0;
+}
+
+/**
+    adds a folded path to the set, which takes it over
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int insert_path(Graphics_set *set, char *path) {
+
+    char **paths = (char **) hash_table_reserve(&path_ops, set->paths, &set->cap, set->count);
+    if (paths == NULL) {
+        free(path);
+        return -1;
+    }
+    set->paths = paths;
+
+    char **slot = find_slot(set, path);
+    if (*slot != NULL)
+        free(path);
+    else {
+        *slot = path;
+        set->count++;
+    }
+    return 0;
+}
+
+/**
+    joins a folder and a path relative to it; an empty path is the folder
+    @return the joined path, or NULL if out of memory
+*/
+static char *join_path(const char *dir, const char *name) {
+
+    char *path = (char *) malloc(strlen(dir) + strlen(name) + 2);
+
+    if (path != NULL)
+        sprintf(path, (*dir && *name) ? "%s/%s" : "%s%s", dir, name);
+    return path;
+}
+
+static void free_dirs(Dir_list *list) {
+
+    for (int d = 0; d < list->count; d++)
+        free(list->dirs[d].path);
+    free(list->dirs);
+    list->dirs = NULL;
+    list->count = 0;
+}
+
+/**
+    adds the files under a directory of the graphics folder to the set, and
+    the directory and those below it to the list of directories visited
+    @param set receives the files' folded paths
+    @param list receives the directories' modification times
+    @param root is the graphics folder
+    @param rel is the directory, relative to the folder
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int scan_dir(Graphics_set *set, Dir_list *list, const char *root, const char *rel) {
+
+    char *dir_path = join_path(root, rel);
+    struct stat st;
+    DIR *dir;
+    struct dirent *entry;
+    int rc = 0;
+
+    if (dir_path == NULL || stat(dir_path, &st) != 0 || (dir = opendir(dir_path)) == NULL) {
+        free(dir_path);
+        return -1;
+    }
+
+    Dir_stamp *temp = (Dir_stamp *) realloc(list->dirs, (list->count + 1) * sizeof(Dir_stamp));
+    if (temp == NULL || (temp[list->count].path = strdup(rel)) == NULL) {
+        if (temp != NULL)
+            list->dirs = temp;
+        closedir(dir);
+        free(dir_path);
+        return -1;
+    }
+    list->dirs = temp;
+    list->dirs[list->count].mtime_sec = (long long) st.st_mtim.tv_sec;
+    list->dirs[list->count++].mtime_nsec = (long) st.st_mtim.tv_nsec;
+
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char *child = join_path(rel, entry->d_name);
+        if (child == NULL) {
+            rc = -1;
+            break;
+        }
+
+        // linked directories are not followed, so a link cannot loop the scan
+        bool is_dir = entry->d_type == DT_DIR;
+        bool is_file = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            char *full = join_path(root, child);
+            if (full != NULL && stat(full, &st) == 0) {
+                is_dir = S_ISDIR(st.st_mode) && entry->d_type == DT_UNKNOWN;
+                is_file = S_ISREG(st.st_mode);
+            }
+            free(full);
+        }
+
+        if (is_dir) {
+            rc = scan_dir(set, list, root, child);
+            free(child);
+        } else if (is_file) {
+            fold_path(child);
+            rc = insert_path(set, child);
+        } else
+            free(child);
+    }
+    closedir(dir);
+    free(dir_path);
+    return rc;
+}
+
+/**
+    writes a snapshot, first to a temporary file that is then renamed, so
+    that a concurrent conversion never reads half of one
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int save_snapshot(const char *name, const char *root, const Graphics_set *set, const Dir_list *list) {
+
+    char *tmp = (char *) malloc(strlen(name) + 5);
+    FILE *fp;
+    int rc = 0;
+
+    if (tmp == NULL)
+        return -1;
+    sprintf(tmp, "%s.tmp", name);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        free(tmp);
+        return -1;
+    }
+
+    fprintf(fp, "%s\t%s\n", GRAPHICS_MAGIC, root);
+    for (int d = 0; d < list->count; d++)
+        fprintf(fp, "D\t%lld\t%ld\t%s\n", list->dirs[d].mtime_sec, list->dirs[d].mtime_nsec, list->dirs[d].path);
+    for (size_t e = 0; e < set->cap; e++)
+        if (set->paths[e] != NULL)
+            fprintf(fp, "F\t%s\n", set->paths[e]);
+
+    if ((fclose(fp) != 0) || (rename(tmp, name) != 0)) {
+        remove(tmp);
+        rc = -1;
+    }
+    free(tmp);
+    return rc;
+}
+
+/**
+    reads a snapshot, unless it is of another folder or any directory it
+    lists has changed since
+    @param name is the snapshot file
+    @param root is the graphics folder
+    @param set receives the paths, and is left empty if the snapshot is
+           missing, out of date or unreadable
+    @return 0 if the snapshot was read, -1 otherwise
+*/
+static int load_snapshot(const char *name, const char *root, Graphics_set *set) {
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    int rc = -1;
+    FILE *fp;
+
+    if ((fp = fopen(name, "r")) == NULL)
+        return -1;
+
+    if ((len = getline(&line, &line_cap, fp)) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        size_t magic_len = strlen(GRAPHICS_MAGIC);
+        if (strncmp(line, GRAPHICS_MAGIC, magic_len) == 0 && line[magic_len] == '\t' &&
+            strcmp(line + magic_len + 1, root) == 0)
+            rc = 0;
+    }
+
+    while (rc == 0 && (len = getline(&line, &line_cap, fp)) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strncmp(line, "F\t", 2) == 0) {
+            char *path = strdup(line + 2);
+            if (path == NULL || insert_path(set, path) != 0)
+                rc = -1;
+
+        } else {
+            // a directory that changed may hold files the snapshot does not
+            long long sec;
+            long nsec;
+            int rel = 0;
+            struct stat st;
+            char *dir_path;
+
+            if (sscanf(line, "D\t%lld\t%ld\t%n", &sec, &nsec, &rel) < 2 || rel == 0 ||
+                (dir_path = join_path(root, line + rel)) == NULL)
+                rc = -1;
+            else {
+                if (stat(dir_path, &st) != 0 || (long long) st.st_mtim.tv_sec != sec ||
+                    (long) st.st_mtim.tv_nsec != nsec)
+                    rc = -1;
+                free(dir_path);
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (rc != 0) {
+        free_graphics(set);
+        init_set(set, set->cap);
+    }
+    return rc;
+}
+
+int load_graphics(Graphics_set *set, const char *root, const char *snapshot) {
+
+    Dir_list list = {NULL, 0};
+
+    if (init_set(set, 1024) != 0)
+        return -1;
+
+    if (snapshot != NULL && load_snapshot(snapshot, root, set) == 0)
+        return 0;
+    if (set->paths == NULL || scan_dir(set, &list, root, "") != 0) {
+        free_dirs(&list);
+        free_graphics(set);
+        return -1;
+    }
+
+    // a snapshot that cannot be written only costs the next run a scan
+    if (snapshot != NULL)
+        save_snapshot(snapshot, root, set, &list);
+    free_dirs(&list);
+    return 0;
+}
+
+bool graphic_exists(const Graphics_set *set, const char *graphic) {
+
+    char path[GRAPHIC_NAME_MAX];
+
+    if (strlen(graphic) >= sizeof(path))
+        return false;
+    strcpy(path, graphic);
+    fold_path(path);
+    return *find_slot(set, path) != NULL;
+}
+
+void free_graphics(Graphics_set *set) {
+
+    for (size_t e = 0; set->paths != NULL && e < set->cap; e++)
+        free(set->paths[e]);
+    free(set->paths);
+    set->paths = NULL;
+    set->count = 0;
+}
@@ -0,0 +1,46 @@
+/**
+    @file graphics.h
+    Together with graphics.c, this component checks that the graphics an
+    IDoc names exist. The graphics folder is scanned once into a hash set
+    of its files' paths, relative to the folder and case-folded, as the
+    folder's share matches them. Each graphic is then one set lookup, with
+    no stat() per cell. The scan can be kept in a snapshot file, reused for
+    as long as the modification time of every directory it lists is
+    unchanged; adding, removing or renaming a file changes its directory's.
+*/
+
+#ifndef STOIDOC_GRAPHICS_H
+#define STOIDOC_GRAPHICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** the case-folded paths of the files in a graphics folder              */
+typedef struct {
+    char **paths;
+    size_t cap;
+    size_t count;
+} Graphics_set;
+
+/**
+    loads the paths of the files under a graphics folder, from the snapshot
+    if it is up to date, and from a scan of the folder otherwise. A scan is
+    saved to the snapshot.
+    @param set receives the paths
+    @param root is the graphics folder
+    @param snapshot is the snapshot file, or NULL to always scan the folder
+    @return 0 if successful, -1 if unsuccessful
+*/
+int load_graphics(Graphics_set *set, const char *root, const char *snapshot);
+
+/**
+    returns true if a graphic is in the set
+    @param set is the graphics folder's paths
+    @param graphic is the graphic's path relative to the folder, with '\'
+           or '/' separators, in any case
+*/
+bool graphic_exists(const Graphics_set *set, const char *graphic);
+
+void free_graphics(Graphics_set *set);
+
+#endif //STOIDOC_GRAPHICS_H
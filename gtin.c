@@ -0,0 +1,215 @@
+/**
+ *  gtin.c
+ */
+#include "gtin.h"
+#include "labelhash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the lengths of the GTINs accepted                                     */
+#define GTIN_13               13
+#define GTIN_14               14
+
+/* the company prefix is the seven digits after the country prefix       */
+#define GTIN_CPNY_LEN         7
+
+/* the highest country prefix accepted                                   */
+#define GTIN_MAX_CTRY         4
+
+/* the weights of a GTIN-14's first thirteen digits, 3 and 1 from the right */
+static const unsigned char check_weights[GTIN_14 - 1] = {3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3};
+
+static bool prefix_used(const void *entry) {
+    return *(const int *) entry != -1;
+}
+
+static bool prefix_matches(const void *entry, const void *key) {
+    return *(const int *) entry == *(const int *) key;
+}
+
+static uint64_t prefix_hash(const void *entry) {
+    return (uint32_t) *(const int *) entry * 2654435761U;
+}
+
+static const Hash_ops prefix_ops = {sizeof(int), prefix_used, prefix_matches, prefix_hash};
+
+static int *prefix_slot(const Prefix_set *set, int prefix) {
+    return (int *) hash_table_slot(&prefix_ops, set->prefixes, set->cap, prefix_hash(&prefix), &prefix);
+}
+
+static bool has_prefix(const Prefix_set *set, int prefix) {
+    return set->count > 0 && *prefix_slot(set, prefix) == prefix;
+}
+
+int parse_gtin_prefixes(const char *list, Prefix_set *set) {
+
+    size_t expected = 1;
+
+    for (const char *cp = list; *cp; cp++)
+        if (*cp == ',')
+            expected++;
+
+    set->cap = hash_table_cap(expected);
+    set->count = 0;
+    if ((set->prefixes = (int *) malloc(set->cap * sizeof(int))) == NULL)
+        return -1;
+    for (size_t s = 0; s < set->cap; s++)
+        set->prefixes[s] = -1;
+
+    const char *cp = list;
+    while (true) {
+        int prefix = 0, digits = 0;
+
+        for (; *cp >= '0' && *cp <= '9'; cp++, digits++)
+            prefix = 10 * prefix + (*cp - '0');
+        if (digits == 0 || digits > GTIN_CPNY_LEN || (*cp != ',' && *cp != '\0')) {
+            free_gtin_prefixes(set);
+            return -1;
+        }
+
+        int *slot = prefix_slot(set, prefix);
+        if (*slot == -1) {
+            *slot = prefix;
+            set->count++;
+        }
+        if (*cp++ == '\0')
+            return 0;
+    }
+}
+
+void free_gtin_prefixes(Prefix_set *set) {
+
+    free(set->prefixes);
+    set->prefixes = NULL;
+    set->cap = 0;
+    set->count = 0;
+}
+
+int check_gtin_digits(const char *value, const Prefix_set *prefixes, int *prefix) {
+
+    size_t len = 0;
+    bool zero = true;
+
+    for (; value[len] != '\0'; len++) {
+        if (value[len] < '0' || value[len] > '9')
+            return GTIN_NONNUMERIC;
+        zero = zero && value[len] == '0';
+    }
+    if (len == 0)
+        return GTIN_NONNUMERIC;
+    if (len != GTIN_13 && len != GTIN_14)
+        return GTIN_BAD_LENGTH;
+
+    int problems = 0;
+
+    // a fixed-length weighted sum, which the compiler can vectorize
+    if (len == GTIN_14) {
+        unsigned sum = 0;
+        for (int d = 0; d < GTIN_14 - 1; d++)
+            sum += check_weights[d] * (unsigned) (value[d] - '0');
+        if ((unsigned) (value[GTIN_14 - 1] - '0') != (10 - sum % 10) % 10)
+            problems |= GTIN_BAD_CHECK_DIGIT;
+    }
+
+    // the country prefix is the first digit, the company prefix the next seven
+    int company = 0;
+    for (int d = 1; d <= GTIN_CPNY_LEN; d++)
+        company = 10 * company + (value[d] - '0');
+
+    *prefix = company;
+    if ((value[0] - '0' > GTIN_MAX_CTRY) || (!zero && !has_prefix(prefixes, company)))
+        problems |= GTIN_BAD_PREFIX;
+    return problems;
+}
+
+static bool gtin_used(const void *entry) {
+    return ((const Gtin_entry *) entry)->used;
+}
+
+static bool gtin_matches(const void *entry, const void *key) {
+    return strcmp(((const Gtin_entry *) entry)->value, (const char *) key) == 0;
+}
+
+static uint64_t gtin_hash(const void *entry) {
+    return fnv1a_string(((const Gtin_entry *) entry)->value);
+}
+
+static const Hash_ops gtin_ops = {sizeof(Gtin_entry), gtin_used, gtin_matches, gtin_hash};
+
+/**
+    returns the slot of a GTIN: its entry, or the empty slot it belongs in
+*/
+static Gtin_entry *find_slot(const Gtin_cache *cache, const char *value) {
+    return (Gtin_entry *) hash_table_slot(&gtin_ops, cache->entries, cache->cap, fnv1a_string(value), value);
+}
+
+static int init_cache(Gtin_cache *cache, size_t cap) {
+
+    cache->cap = cap;
+    cache->count = 0;
+    cache->entries = (Gtin_entry *) calloc(cap, sizeof(Gtin_entry));
+    return cache->entries == NULL ? -1 : 0;
+}
+
+/**
+    adds a GTIN to the cache, unchecked, unless it is there already
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int insert_value(Gtin_cache *cache, const char *value) {
+
+    Gtin_entry *entries = (Gtin_entry *) hash_table_reserve(&gtin_ops, cache->entries, &cache->cap, cache->count);
+    if (entries == NULL)
+        return -1;
+    cache->entries = entries;
+
+    Gtin_entry *entry = find_slot(cache, value);
+    if (!entry->used) {
+        strcpy(entry->value, value);
+        entry->used = true;
+        cache->count++;
+    }
+    return 0;
+}
+
+int check_all_gtins(Gtin_cache *cache, const Prefix_set *prefixes, const Label_record *labels, int count) {
+
+    if (init_cache(cache, 1024) != 0)
+        return -1;
+
+    // first gather the distinct values, then check them in one pass
+    for (int i = 1; i < count; i++)
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            if (label_fields[f].store != STORE_GTIN)
+                continue;
+
+            const char *value = field_text(&labels[i], &label_fields[f]);
+            if (strlen(value) > 0 && strlen(value) < MED && insert_value(cache, value) != 0) {
+                free_gtin_cache(cache);
+                return -1;
+            }
+        }
+
+    for (size_t e = 0; e < cache->cap; e++)
+        if (cache->entries[e].used)
+            cache->entries[e].problems = check_gtin_digits(cache->entries[e].value, prefixes,
+                                                           &cache->entries[e].prefix);
+    return 0;
+}
+
+const Gtin_entry *find_gtin(const Gtin_cache *cache, const char *value) {
+
+    if (cache->entries == NULL)
+        return NULL;
+
+    const Gtin_entry *entry = find_slot(cache, value);
+    return entry->used ? entry : NULL;
+}
+
+void free_gtin_cache(Gtin_cache *cache) {
+
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->cap = 0;
+    cache->count = 0;
+}
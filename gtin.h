@@ -0,0 +1,93 @@
+/**
+    @file gtin.h
+    Together with gtin.c, this component validates GTINs: their length,
+    check digit and country and company prefixes. The check digit is worked
+    out from the digit characters themselves, with no conversion to an
+    integer. The company prefixes allowed are a hash set, 4026704 and
+    5060112 unless configured otherwise. The GTINs of all barcode columns
+    of all rows are checked in one batch before any IDoc is written, and
+    each distinct value's result is kept in a cache that the writers then
+    look up; after the batch the cache is only read, so any thread can.
+*/
+
+#ifndef STOIDOC_GTIN_H
+#define STOIDOC_GTIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "label.h"
+
+/* the company prefixes allowed unless configured otherwise              */
+#define DEFAULT_GTIN_PREFIXES "4026704,5060112"
+
+/* the problems check_gtin_digits() finds, as bits                       */
+#define GTIN_NONNUMERIC       0x01
+#define GTIN_BAD_LENGTH       0x02
+#define GTIN_BAD_CHECK_DIGIT  0x04
+#define GTIN_BAD_PREFIX       0x08
+
+/** the company prefixes a GTIN may carry; an empty slot holds -1        */
+typedef struct {
+    int *prefixes;
+    size_t cap;
+    size_t count;
+} Prefix_set;
+
+/** a distinct GTIN and the result of checking it                        */
+typedef struct {
+    char value[MED];
+    int problems;
+    int prefix;
+    bool used;
+} Gtin_entry;
+
+/** an open-addressing hash table of the GTINs checked                   */
+typedef struct {
+    Gtin_entry *entries;
+    size_t cap;
+    size_t count;
+} Gtin_cache;
+
+/**
+    reads a comma-separated list of company prefixes into a set
+    @param list is the list, e.g. "4026704,5060112"
+    @param set receives the prefixes
+    @return 0 if successful, -1 if a prefix is not 1 to 7 digits or memory
+    runs out
+*/
+int parse_gtin_prefixes(const char *list, Prefix_set *set);
+
+void free_gtin_prefixes(Prefix_set *set);
+
+/**
+    checks a GTIN's length, check digit and prefix. Only a 14-digit GTIN
+    has its check digit checked. A GTIN of all zeros is a placeholder and
+    is not checked for its company prefix.
+    @param value is the GTIN text
+    @param prefixes is the company prefixes allowed
+    @param prefix receives the company prefix, if it is checked
+    @return the GTIN_* problems found, or 0 if the GTIN is valid
+*/
+int check_gtin_digits(const char *value, const Prefix_set *prefixes, int *prefix);
+
+/**
+    checks every distinct value of every GTIN column of the label records,
+    once each, and keeps the results
+    @param cache receives the results
+    @param prefixes is the company prefixes allowed
+    @param labels is the label records, from labels[1]
+    @param count is the number of records, labels[0] included
+    @return 0 if successful, -1 if unsuccessful
+*/
+int check_all_gtins(Gtin_cache *cache, const Prefix_set *prefixes, const Label_record *labels, int count);
+
+/**
+    finds a GTIN's result in the cache
+    @return the GTIN's entry, or NULL if it was not checked in the batch
+*/
+const Gtin_entry *find_gtin(const Gtin_cache *cache, const char *value);
+
+void free_gtin_cache(Gtin_cache *cache);
+
+#endif //STOIDOC_GTIN_H
@@ -4,53 +4,59 @@
  *  idoc file.
  */
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "label.h"
 #include "strl.h"
 #include "lookup.h"
+#include "stream.h"
+#include "ctrlnum.h"
+#include "rowindex.h"
+#include "labelhash.h"
+#include "graphics.h"
+#include "snapshot.h"
+#include "gtin.h"
+#include "reccache.h"
 
 /* end of line new line character                                        */
 #define LF '\n'
 
-/* if the -F command line parameter is present, F_ is activated          */
-//#define F_ "F_"
-#define F_ ""
-
 /* length of '_idoc (stoidoc 2.0)->txt' extension                        */
 #define FILE_EXT_LEN   36
 
-/* length of GTIN-13                                                     */
-#define GTIN_13        13
-
-/* divide a 14-digit GTIN by this value to isolate its first digit       */
-#define GTIN_14_DIGIT 10000000000000
+/* length of the '_001' shard number, which may grow past three digits   */
+#define SHARD_EXT_LEN  12
 
-/* divide a 13-digit GTIN by this value to isolate its first digit       */
-#define GTIN_13_DIGIT 1000000000000
+/* whether or not to include non-SAP fields in IDoc                      */
+bool non_SAP_fields = false;
 
-/* divide a GTIN by these values to isolate company prefix               */
-#define GTIN_14_CPNY_DIVISOR 1000000
-#define GTIN_13_CPNY_DIVISOR 100000
+/* the fields some IDoc variant prints, marked by init_variant()         */
+bool wanted_fields[FIELD_COUNT];
 
-/* the number of spaces to indent the TDline lines                       */
-#define TDLINE_INDENT  61
+/* whether or not to gzip-compress the IDoc as it is written             */
+bool compress_output = false;
 
-/* normal graphics folder path                                           */
-#define GRAPHICS_PATH  "T:\\MEDICAL\\NA\\RTP\\TEAM CENTER\\TEMPLATES\\GRAPHICS\\"
+/* whether or not to continue IDocs from their checkpoints                */
+bool resume_output = false;
 
-/* alternate graphics folder path                                        */
-#define ALT_GRAPHICS_PATH  "C:\\Users\\jkottiel\\Documents\\1 - Teleflex\\Labeling Resources\\Personal Graphics\\"
+/* the company prefixes a GTIN may carry                                 */
+Prefix_set gtin_prefixes = {NULL, 0, 0};
 
-/* determine the graphics path at run time                               */
-bool alt_path = false;
+/* every distinct GTIN of the labels, checked once before any IDoc is written */
+Gtin_cache gtin_cache = {NULL, 0, 0};
 
-/* whether or not to include non-SAP fields in IDoc                      */
-bool non_SAP_fields = false;
+/* the graphic records of the labels, rendered once per column, value and path */
+Record_cache graphic_records = {NULL, 0, 0};
 
 /* global variable that holds the spreadsheets specific column headings  */
 char **spreadsheet;
@@ -61,87 +67,148 @@ int spreadsheet_cap = 0;
 /* tracks the actual number of label rows in the spreadsheet             */
 int spreadsheet_row_number = 0;
 
-/* global variable to track the idoc sequence number                     */
-int sequence_number = 1;
+/* length of the longest spreadsheet row, which bounds any one cell       */
+size_t spreadsheet_width = 0;
+
+/* the length of the segment name, control and sequence numbers and
+   record type that start every record after the control record         */
+#define RECORD_PREFIX_LEN   63
+
+/* the length of the control record, including its line feed             */
+#define CONTROL_RECORD_LEN 525
+
+/* the width of a material or label number and of a TDLINE text line      */
+#define KEY_LEN             18
+#define TDLINE_LEN          74
+
+/* the length of a flag's characteristic record, including its line feed */
+#define FLAG_RECORD_LEN    (RECORD_PREFIX_LEN + 2 * CHAR_COL_LEN + GRAPHIC_PATH_LEN + 1)
+
+/* the tag that starts the text of every TDLINE record                  */
+#define TDLINE_TAG         "GRUNE  ENMATERIAL  "
+
+/* the most records one IDoc can number: sequence numbers have six digits */
+#define MAX_SEQUENCE_NUMBER 999999
+
+/* the labels written between checkpoints, and the checkpoint extensions */
+#define CHECKPOINT_INTERVAL 1000
+#define CHECKPOINT_EXT      ".ckpt"
+#define TMP_EXT             ".tmp"
+
+/* the sidecar index extension, and the layout of its fixed-width lines  */
+#define INDEX_EXT           ".idx"
+#define INDEX_LABEL_LEN     KEY_LEN
+#define INDEX_MATERIAL_LEN  (LRG - 1)
+#define INDEX_FORMAT        "%-*s %012ld %010ld %06d %06d %-*s\n"
+#define INDEX_ENTRY_LEN     (INDEX_LABEL_LEN + 12 + 10 + 6 + 6 + INDEX_MATERIAL_LEN + 6)
+
+/* the size at which a preallocated IDoc is cut into another run of labels */
+#define RUN_SIZE           (1 << 20)
+
+/* the most IDoc variants one run can write: each of -n and -J on or off */
+#define MAX_VARIANTS    4
 
-char prev_material[MED] = {0};
+/** the pre-rendered text of a flag's characteristic record              */
+typedef struct {
+    char name[CHAR_COL_LEN + 1];
+    char yes_path[GRAPHIC_PATH_LEN + 1];
+    char no_path[GRAPHIC_PATH_LEN + 1];
+} Flag_record;
 
-/** a global struct variable of IDoc sequence numbers                    */
+/**
+    one IDoc variant to write: its options, the text and emit plan
+    init_variant() renders from them, and the output file
+*/
+typedef struct {
+    bool alt_path;
+    bool non_SAP_fields;
+    bool report;
+
+    Flag_record flag_records[FLAG_COUNT];
+    const Field_def *emit_plan[FIELD_COUNT];
+    int emit_plan_len;
+
+    Label_record *labels;
+} Variant;
+
+/** where a label's records are in its IDoc, for the sidecar index       */
+typedef struct {
+    long offset;
+    long length;
+    int first_seq;
+    int last_seq;
+    char material[LRG];
+} Index_entry;
+
+/** the base version of a delta: its label records and a table of its labels */
+typedef struct {
+    Label_record *labels;
+    int count;
+    Label_table table;
+} Delta_base;
+
+/**
+    one IDoc file to write: a run of a variant's label rows, which never
+    splits a material group. Every shard is a complete IDoc.
+*/
+typedef struct {
+    Variant *variant;
+    int first;
+    int last;
+    char *outputfile;
+    int fd;
+    char ctrl_num[CONTROL_NUMBER_LEN + 1];
+
+    // the sidecar index entry of each label, or NULL without -I
+    Index_entry *index;
+} Shard;
+
+/** a struct variable of IDoc sequence numbers and the variant's state   */
 struct control_numbers {
-    char ctrl_num[8];
+    char ctrl_num[CONTROL_NUMBER_LEN + 1];
     int matl_seq_number;
     int labl_seq_number;
     int tdline_seq_number;
     int char_seq_number;
+
+    // the idoc sequence number and the previously printed material
+    int sequence_number;
+    char prev_material[LRG];
+
+    // the variant being printed; only its report flag lets it print diagnostics
+    const Variant *variant;
 };
 
 /** defining the struct variable as a new type for convenience           */
 typedef struct control_numbers Ctrl;
 
 /**
-    Returns true (non-zero) if character-string parameter represents
-    a signed or unsigned floating-point number. Otherwise returns
-    false (zero).
-    @param str is the numeric string value to evaluate
-    @return true if str is a number, false otherwise
- */
-int isNumeric(const char *str) {
-
-    if (str == NULL || str[0] == '\0')
-        return 0;
-
-    int i = 0;
-    while (str[i] != '\0')
-        if (isdigit(str[i]) == 0)
-            return 0;
-        else
-            i++;
-    return 1;
-}
-
-/**
-    Returns true (non-zero) if character-string parameter contains any
-    spaces. Otherwise returns false (zero).
-    @param str is the string to evaluate
-    @return true if str contains spaces, false otherwise
- */
-int containsSpaces(const char *str) {
-
-    if (str == NULL || str[0] == '\0')
-        return 0;
-
-    int i = 0;
-    while (str[i] != '\0')
-        if (str[i] == ' ')
-            return 1;
-        else
-            i++;
-    return 0;
-}
+    a run of a shard's labels that one worker writes. A shard written
+    through stdio is a single run; a preallocated shard is cut into runs
+    that are rendered in parallel and written at their offsets.
+*/
+typedef struct {
+    Shard *shard;
+    int first;
+    int last;
 
-/**
-    determine the check digit of a GTIN-13 format value
-    @param lp is the GTIN-13 value to calculate a check digit for
-    @return a check digit
- */
-int checkDigit(const long long *llp) {
+    // the sequence numbers and material before the first label
+    Ctrl start;
 
-    long long gtin = *llp;
-    gtin = gtin / 10;
-    short digit;
-    int sum = 0;
+    // where the run starts in the preallocated file, or -1 to stream the shard
+    off_t offset;
+    size_t size;
+    int status;
+} Run;
 
-    while (gtin > 0) {
-        digit = (short) (gtin % 10);
-        sum += 3 * digit;
-        gtin /= 10;
-        digit = (short) (gtin % 10);
-        sum += 1 * digit;
-        gtin /= 10;
-    }
+/* flag record text shared by all variants, rendered once by init_flag_names() */
+static char graphic0x_names[FLAG_COUNT][CHAR_COL_LEN + 1];
+static char yes_value[CHAR_COL_LEN + 1];
+static char no_value[CHAR_COL_LEN + 1];
 
-    return (sum % 10 == 0 ? 0 : ((((sum / 10) * 10) + 10) - sum));
-}
+/* the flags printed as GRAPHIC0x records and as boolean records         */
+static uint64_t graphic0x_mask;
+static uint64_t boolean_mask;
 
 /**
     check to ensure SAP Characteristic Value Lookup table is alphabetized
@@ -165,7 +232,7 @@ bool check_lookup_array() {
     @param needle is the search term
     @return the corresponding SAP lookup value, or null if not found
 */
-char *sap_lookup(char *needle) {
+char *sap_lookup(const char *needle) {
 
     int start = 0;
     int end = lookupsize - 1;
@@ -175,7 +242,7 @@ char *sap_lookup(char *needle) {
     bool exit = false;
     char *haystack;
 
-    while (!exit) {
+    while (!exit && start <= end) {
         if (middle != (end - start) / 2 + start)
             middle = (end - start) / 2 + start;
         else
@@ -194,44 +261,84 @@ char *sap_lookup(char *needle) {
     return NULL;
 }
 
+/**
+    stores the row collected in buffer as the next spreadsheet row, growing
+    the spreadsheet array as needed
+    @param buffer holds the row's characters (not null-terminated)
+    @param length is the number of characters in the row
+*/
+void add_spreadsheet_row(const char *buffer, size_t length) {
+
+    if (spreadsheet_row_number >= spreadsheet_cap) {
+        if (spreadsheet_expand() != 0) {
+            printf("Could not expand spreadsheet array. Exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((spreadsheet[spreadsheet_row_number] = (char *) malloc(length + 1)) == NULL) {
+        printf("Could not allocate spreadsheet row %d. Exiting\n", spreadsheet_row_number);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(spreadsheet[spreadsheet_row_number], buffer, length);
+    spreadsheet[spreadsheet_row_number][length] = '\0';
+    spreadsheet_row_number++;
+
+    if (length > spreadsheet_width)
+        spreadsheet_width = length;
+}
+
 /**
     reads a tab-delimited Excel spreadsheet into memory, dynamically
     allocating memory to hold the rows as needed. All CRLF and LF are
     replaced with null characters to delimit the end of the spreadsheet
     row / string. Rows containing just tab characters are ignored.
+    Rows may be of any length: they are collected in a single line buffer
+    that doubles whenever it fills, and each row is then stored at its
+    exact size.
     @param fp points to the input file
 */
 void read_spreadsheet(FILE *fp) {
 
-    char c;
-    char buffer[MAX_COLUMNS];
+    int c;
+    size_t buffer_cap = INITIAL_ROW_WIDTH;
+    char *buffer = (char *) malloc(buffer_cap);
     bool line_not_empty = false;
-    int i = 0;
+    size_t i = 0;
+
+    if (buffer == NULL) {
+        printf("Could not allocate the spreadsheet line buffer. Exiting\n");
+        exit(EXIT_FAILURE);
+    }
 
-    while ((c = (char) fgetc(fp)) != EOF) {
+    while ((c = getc(fp)) != EOF) {
         if (c == LF) {
             //check if preceded by "##" - in that case do nothing
-            if ((i > 1) && buffer[i - 1] != '#' || buffer[i - 2] != '#') {
-                buffer[i] = '\0';
-                if (line_not_empty) {
-                    if (spreadsheet_row_number >= spreadsheet_cap) {
-                        spreadsheet_expand();
-                    }
-                    spreadsheet[spreadsheet_row_number] =
-                            (char *) malloc(i * sizeof(char) + 2);
-                    strlcpy(spreadsheet[spreadsheet_row_number], buffer, MAX_COLUMNS);
-                    spreadsheet_row_number++;
-                }
+            if ((i < 2) || buffer[i - 1] != '#' || buffer[i - 2] != '#') {
+                if (line_not_empty)
+                    add_spreadsheet_row(buffer, i);
                 i = 0;
                 line_not_empty = false;
             }
         } else {
-            buffer[i++] = c;
+            if (i == buffer_cap) {
+                buffer_cap *= 2;
+                if ((buffer = (char *) realloc(buffer, buffer_cap)) == NULL) {
+                    printf("Could not grow the spreadsheet line buffer. Exiting\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            buffer[i++] = (char) c;
             if (c != '\t')
                 if (c != '\r')
                     line_not_empty = true;
         }
     }
+
+    // the last row need not end with a line feed
+    if (line_not_empty)
+        add_spreadsheet_row(buffer, i);
+
+    free(buffer);
 }
 
 /**
@@ -248,10 +355,11 @@ void print_spaces(FILE *fpout, int n) {
     prints a portion of an idoc field record based on the passed parameter
     @param fpout points to the output file
     @param graphic is the name of the graphic to append to the path and to print
+    @param idoc selects the variant's graphics path
 */
-void print_graphic_path(FILE *fpout, char *graphic) {
+void print_graphic_path(FILE *fpout, const char *graphic, const Ctrl *idoc) {
     int n = 0;
-    if (alt_path) {
+    if (idoc->variant->alt_path) {
         fprintf(fpout, "%s", ALT_GRAPHICS_PATH);
         n = 255 - ((int) strlen(ALT_GRAPHICS_PATH) + (int) strnlen(graphic, MED + 1));
     } else {
@@ -270,24 +378,25 @@ void print_graphic_path(FILE *fpout, char *graphic) {
     @param ctrl_num
     @param n is the number of spaces to print
 */
-void print_Z2BTLC01000(FILE *fpout, char *ctrl_num, int char_seq_number) {
+void print_Z2BTLC01000(FILE *fpout, Ctrl *idoc) {
     fprintf(fpout, "Z2BTLC01000");
     print_spaces(fpout, 19);
     fprintf(fpout, "500000000000");
     // cols 22-29 - 7 digit control number?
-    fprintf(fpout, "%s", ctrl_num);
-    fprintf(fpout, "%06d", sequence_number++);
-    fprintf(fpout, "%06d", char_seq_number);
+    fprintf(fpout, "%s", idoc->ctrl_num);
+    fprintf(fpout, "%06d", idoc->sequence_number++);
+    fprintf(fpout, "%06d", idoc->char_seq_number);
     fprintf(fpout, CHAR_REC);
 }
 
-void print_info_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl *idoc) {
+void print_info_column_header(FILE *fpout, const char *col_name, const char *col_value, Cell_tag tag, Ctrl *idoc) {
 
-    if (strlen(col_value) > 0) {
-        if (equals_no(col_value) > 0) // it is blank, but should be treated as "NO"
-            strcpy(col_value, "NO");
+    if (tag.length > 0) {
+        // a "N" cell is printed as "NO"
+        if (cell_class(tag) == CELL_NO)
+            col_value = "NO";
 
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+        print_Z2BTLC01000(fpout, idoc);
         fprintf(fpout, "%-30s", col_name);
         fprintf(fpout, "%-30s", col_value);
         fprintf(fpout, "%-255s", col_value);
@@ -302,73 +411,59 @@ void print_info_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl
     @param fpout points to the output file
     @param col_name is the column name from the spreadsheet
     @param col_value is the contents of the labels cell beneath the column name
+    @param tag is the cell's tag
     @param default_yes is the graphic item to print if col_value is a Y / Yes
     @param idoc contains the sequence and control numbers struct
  */
-void print_graphic_column_header(FILE *fpout, char *col_name, char *col_value, char *default_yes, Ctrl *idoc) {
+void print_graphic_column_header(FILE *fpout, const char *col_name, const char *col_value, Cell_tag tag,
+                                 const char *default_yes, Ctrl *idoc) {
 
-    char cell_contents[MED];
-    strncpy(cell_contents, col_value, MED - 1);
+    // only print a record if the cell contains a value
+    if (tag.length > 0) {
 
-    // only print a record if the cell_contents contains a value
-    if (strlen(cell_contents) > 0) {
-
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+        print_Z2BTLC01000(fpout, idoc);
         fprintf(fpout, "%-30s", col_name);
         fprintf(fpout, "%-30s", col_value);
 
-        if (equals_yes(col_value)) {
-            strncpy(cell_contents, default_yes, MED - 1);
-            print_graphic_path(fpout, cell_contents);
-        } else if (equals_no(col_value)) {
-            print_graphic_path(fpout, "blank-01.tif");
+        if (cell_class(tag) == CELL_YES) {
+            print_graphic_path(fpout, default_yes, idoc);
+        } else if (cell_class(tag) == CELL_NO) {
+            print_graphic_path(fpout, "blank-01.tif", idoc);
         } else {
 
             // graphic_name will be converted to its SAP lookup value from the static lookup array
             // or, if there is no lookup value, graphic_name itself will be used
             char *gnp = sap_lookup(col_value);
+            char graphic_name[LRG + SML];
 
-            if (gnp) {
-                char graphic_name[LRG];
-                strncpy(graphic_name, gnp, LRG - 1);
-                print_graphic_path(fpout, strcat(graphic_name, ".tif"));
-            } else {
-                print_graphic_path(fpout, strcat(cell_contents, ".tif"));
-            }
+            snprintf(graphic_name, sizeof(graphic_name), "%s.tif", gnp ? gnp : col_value);
+            print_graphic_path(fpout, graphic_name, idoc);
         }
         fprintf(fpout, "\n");
     }
 }
 
 /**
-    print a passed column-field that contains a "Y" / "Yes", "N" or "NO," (case insensitive),
-    or a value requiring SAP lookup and substitution, or a value that translates
-    into a graphic name with a .tif suffix.
+    print a graphic column-field's name and value, but a blank graphic path
     @param fpout points to the output file
     @param col_name is the column name from the spreadsheet
     @param col_value is the contents of the labels cell beneath the column name
-    @param default_yes is the graphic item to print if col_value is a Y / Yes
     @param idoc contains the sequence and control numbers struct
  */
-void print_blank_graphic_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl *idoc) {
-
-    char cell_contents[MED];
-    strncpy(cell_contents, col_value, MED - 1);
+void print_blank_graphic_column_header(FILE *fpout, const char *col_name, const char *col_value, Ctrl *idoc) {
 
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+    print_Z2BTLC01000(fpout, idoc);
     fprintf(fpout, "%-30s", col_name);
     fprintf(fpout, "%-30s", col_value);
 
-    print_graphic_path(fpout, "");
+    print_graphic_path(fpout, "", idoc);
     fprintf(fpout, "\n");
 }
 
-void print_info_lookup_column_header(FILE *fpout, char *col_name, char *col_value, char *lookup, Ctrl *idoc) {
+void print_info_lookup_column_header(FILE *fpout, const char *col_name, const char *col_value,
+                                     const char *lookup, Ctrl *idoc) {
 
-    char cell_contents[MED];
-    strncpy(cell_contents, col_value, MED - 1);
-
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+    print_Z2BTLC01000(fpout, idoc);
     fprintf(fpout, "%-30s", col_name);
     fprintf(fpout, "%-30s", col_value);
     fprintf(fpout, "%-255s", lookup);
@@ -376,53 +471,126 @@ void print_info_lookup_column_header(FILE *fpout, char *col_name, char *col_valu
 }
 
 /**
-    print a passed column-field that is in the special GRAPHICS01 - GRAPHICS14 category and is defined as
-    boolean in the Label_record. It contains a "Y" or a "N." If "Y," print the hard-coded value associated with
-    the graphic and a .tif suffix. Otherwise, print a "blank-01.tif" record.
+    renders the graphic path portion of a characteristic record, padded the
+    same way print_graphic_path() pads it
+    @param dst receives the path; it must hold GRAPHIC_PATH_LEN + 1 chars
+    @param graphic is the name of the graphic to append to the path
+    @param alt_path selects the alternate graphics path
+*/
+void render_graphic_path(char *dst, const char *graphic, bool alt_path) {
+    const char *path = alt_path ? ALT_GRAPHICS_PATH : GRAPHICS_PATH;
+    snprintf(dst, GRAPHIC_PATH_LEN + 1, "%s%-*s", path,
+             GRAPHIC_PATH_LEN - (int) strlen(path), graphic);
+}
+
+/**
+    renders the GRAPHIC01 - GRAPHIC14 names and Y / N values, and finds the
+    flags that are printed as GRAPHIC0x and as boolean records. These are
+    the same for every variant.
+*/
+void init_flag_names() {
+
+    snprintf(yes_value, sizeof(yes_value), "%-*s", CHAR_COL_LEN, "Y");
+    snprintf(no_value, sizeof(no_value), "%-*s", CHAR_COL_LEN, "N");
+    for (int g = 0; g < FLAG_COUNT; g++)
+        snprintf(graphic0x_names[g], sizeof(graphic0x_names[g]), "GRAPHIC%02d%*s", g + 1, CHAR_COL_LEN - 9, "");
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (label_fields[f].emit == EMIT_GRAPHIC0X)
+            graphic0x_mask |= FLAG_YES(label_fields[f].flag);
+        else if (label_fields[f].emit == EMIT_BOOLEAN)
+            boolean_mask |= FLAG_YES(label_fields[f].flag);
+    }
+}
+
+/**
+    pre-renders the text of every flag's records for a variant and builds
+    its emit plan: the schema fields printed for every label, in order.
+    Non-SAP fields are left out unless the variant includes them. Each
+    field printed is marked in wanted_fields, so that only the columns
+    some variant prints are parsed.
+    @param v is the variant, with its options set
+*/
+void init_variant(Variant *v) {
+
+    v->emit_plan_len = 0;
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        const Field_def *field = &label_fields[f];
+
+        if ((field->attrs & ATTR_NON_SAP) && !v->non_SAP_fields)
+            continue;
+        wanted_fields[f] = true;
+
+        if (field->store == STORE_FLAG) {
+            Flag_record *rec = &v->flag_records[field->flag];
+            snprintf(rec->name, sizeof(rec->name), "%-*s", CHAR_COL_LEN, field->column);
+            if (field->emit == EMIT_BOOLEAN_HEADER) {
+                render_graphic_path(rec->yes_path, "Yes", v->alt_path);
+                render_graphic_path(rec->no_path, "No", v->alt_path);
+            } else {
+                render_graphic_path(rec->yes_path, field->graphic, v->alt_path);
+                render_graphic_path(rec->no_path, "blank-01.tif", v->alt_path);
+            }
+        }
+
+        // a run of GRAPHIC0x or boolean flags is printed as one step
+        if ((field->emit == EMIT_GRAPHIC0X || field->emit == EMIT_BOOLEAN) &&
+            (v->emit_plan_len > 0) && (v->emit_plan[v->emit_plan_len - 1]->emit == field->emit))
+            continue;
+        v->emit_plan[v->emit_plan_len++] = field;
+    }
+}
+
+/**
+    prints a GRAPHIC01 - GRAPHIC14 record for each GRAPHIC0x flag set to yes,
+    numbering them in the order they are printed. Flags that are not set are
+    never visited.
     @param fpout points to the output file
-    @param col_name is the column header
-    @param value is the boolean value of the column-field
-    @param graphic_name is the graphic to print if the boolean is true
+    @param flags is the label's flags word
     @param idoc is the struct that tracks the control numbers
  */
-void print_graphic0x_record(FILE *fpout, int *g_cnt, char *graphic_name, unsigned int value, Ctrl *idoc) {
-
-    if (value == 2) {
-        char g_cnt_str[03];
-        char graphic[10] = "GRAPHIC0";
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        sprintf(g_cnt_str, "%d", (*g_cnt)++);
-        fprintf(fpout, "%-30s", strcat(graphic, g_cnt_str));
-        fprintf(fpout, "%-30s", "Y");
-        print_graphic_path(fpout, graphic_name);
-        fprintf(fpout, "\n");
+void print_graphic0x_records(FILE *fpout, uint64_t flags, Ctrl *idoc) {
+
+    uint64_t bits = flags & graphic0x_mask;
+    int g_cnt = 0;
+
+    while (bits) {
+        int flag = __builtin_ctzll(bits);
+        bits &= bits - 1;
+
+        print_Z2BTLC01000(fpout, idoc);
+        fputs(graphic0x_names[g_cnt++], fpout);
+        fputs(yes_value, fpout);
+        fputs(idoc->variant->flag_records[flag].yes_path, fpout);
+        fputc(LF, fpout);
     }
 }
 
 /**
-    print a passed column-field that is defined as boolean in the Label_record. It contains a "Y" or a "N."
-    If "Y," print the hard-coded value associated with the graphic and a .tif suffix. Otherwise, print a
-    "blank-01.tif" record.
+    prints a record for each boolean flag that is set to yes ("Y" and its
+    graphic) or no ("N" and a "blank-01.tif" graphic). Flags that are not
+    set are never visited.
     @param fpout points to the output file
-    @param col_name is the column header
-    @param value is the boolean value of the column-field
-    @param graphic_name is the graphic to print if the boolean is true
+    @param flags is the label's flags word
     @param idoc is the struct that tracks the control numbers
  */
-void print_boolean_record(FILE *fpout, char *col_name, int value, char *graphic_name, Ctrl *idoc) {
-    if (value) {
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        fprintf(fpout, "%-30s", col_name);
+void print_boolean_records(FILE *fpout, uint64_t flags, Ctrl *idoc) {
 
-        if (value == 2) {
-            fprintf(fpout, "%-30s", "Y");
-            print_graphic_path(fpout, graphic_name);
+    uint64_t bits = (flags | (flags >> FLAG_WORD_BITS)) & boolean_mask;
 
-        } else {
-            fprintf(fpout, "%-30s", "N");
-            print_graphic_path(fpout, "blank-01.tif");
-        }
-        fprintf(fpout, "\n");
+    while (bits) {
+        int flag = __builtin_ctzll(bits);
+        bool yes = (flags & FLAG_YES(flag)) != 0;
+        bits &= bits - 1;
+
+        print_Z2BTLC01000(fpout, idoc);
+        const Flag_record *rec = &idoc->variant->flag_records[flag];
+
+        fputs(rec->name, fpout);
+        fputs(yes ? yes_value : no_value, fpout);
+        fputs(yes ? rec->yes_path : rec->no_path, fpout);
+        fputc(LF, fpout);
     }
 }
 
@@ -430,24 +598,62 @@ void print_boolean_record(FILE *fpout, char *col_name, int value, char *graphic_
     print a passed column-field that is defined as boolean in the Label_record. It contains a "Y" or a "N."
     If "Y," print just a "Yes." Otherwise, print just a "No."
     @param fpout points to the output file
-    @param col_name is the column header
-    @param value is the boolean value of the column-field
-    @param graphic_name is the graphic to print if the boolean is true
+    @param field is the schema entry of the flag
+    @param flags is the label's flags word
     @param idoc is the struct that tracks the control numbers
  */
-void print_boolean_column_header(FILE *fpout, char *col_name, bool value, Ctrl *idoc) {
+void print_boolean_column_header(FILE *fpout, const Field_def *field, uint64_t flags, Ctrl *idoc) {
 
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-    fprintf(fpout, "%-30s", col_name);
+    const Flag_record *rec = &idoc->variant->flag_records[field->flag];
+    bool yes = (flags & FLAG_YES(field->flag)) != 0;
 
-    if (value) {
-        fprintf(fpout, "%-30s", "Y");
-        print_graphic_path(fpout, "Yes");
-    } else {
-        fprintf(fpout, "%-30s", "N");
-        print_graphic_path(fpout, "No");
-    }
-    fprintf(fpout, "\n");
+    print_Z2BTLC01000(fpout, idoc);
+    fputs(rec->name, fpout);
+    fputs(yes ? yes_value : no_value, fpout);
+    fputs(yes ? rec->yes_path : rec->no_path, fpout);
+    fputc(LF, fpout);
+}
+
+/**
+    checks a GTIN's length, check digit and prefix, from the batch's cache
+    if the GTIN was checked in it
+    @param value is the GTIN text
+    @param prefix receives the company prefix, if it is checked
+    @return the GTIN_* problems found, or 0 if the GTIN is valid
+*/
+int check_gtin(const char *value, int *prefix) {
+
+    const Gtin_entry *entry = find_gtin(&gtin_cache, value);
+
+    if (entry == NULL)
+        return check_gtin_digits(value, &gtin_prefixes, prefix);
+    *prefix = entry->prefix;
+    return entry->problems;
+}
+
+/**
+    reports a GTIN with an invalid length, check digit or prefix
+    @param value is the GTIN text
+    @param record is the record number being processed
+    @param report_nonnumeric if true, a nonnumeric value is reported as well
+    @param idoc is a Ctrl structure; only a reporting variant prints anything
+*/
+void validate_gtin(const char *value, int record, bool report_nonnumeric, const Ctrl *idoc) {
+
+    int prefix = 0;
+
+    if (!idoc->variant->report)
+        return;
+
+    int problems = check_gtin(value, &prefix);
+    if ((problems & GTIN_NONNUMERIC) && report_nonnumeric)
+        printf("Nonnumeric GTIN \"%s\" in record %d. \n", value, record);
+    if (problems & GTIN_BAD_LENGTH)
+        printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", value, record);
+    if (problems & GTIN_BAD_CHECK_DIGIT)
+        printf("Invalid GTIN check digit \"%s\" in record %d.\n", value, record);
+    if (problems & GTIN_BAD_PREFIX)
+        printf("Invalid GTIN prefix \"%d\" in record %d.\n", prefix, record);
 }
 
 /**
@@ -457,7 +663,8 @@ void print_boolean_column_header(FILE *fpout, char *col_name, bool value, Ctrl *
 int print_control_record(FILE *fpout, Ctrl *idoc) {
 
     time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+    struct tm tm;
+    localtime_r(&t, &tm);
 
     // line 1
     fprintf(fpout, "EDI_DC40  500000000000");
@@ -484,480 +691,2186 @@ int print_control_record(FILE *fpout, Ctrl *idoc) {
 }
 
 /**
-    prints the remaining IDoc records based on the number
-    of label records.
+    prints the MATERIAL record, unless the label's material is blank or the
+    same as the previous label's
     @param fpout points to the output file
-    @param labels is the array of label records
-    @param cols is the column header struct that contains all of the column names
-    @param record is the record number being processed
+    @param label is the label record being processed
     @param idoc is a Ctrl structure containing sequence numbers
-    @return true if a label_idoc_record was printed successfully
 */
-int print_label_idoc_records(FILE *fpout, Label_record *labels, int record, Ctrl *idoc) {
+void print_material_record(FILE *fpout, const Label_record *label, Ctrl *idoc) {
 
-    // Print the records for a given IDOC (labels[record])
-
-    // temporary variables to examine field contents
-    char graphic_val[MED];
-    //char prev_material[MED] = {0};
-
-    // MATERIAL record (optional)
-    // (this is skipped if the previous material record is the same)
-    if ((strlen(labels[record].material) > 0)) {
-
-        // check whether it's a new material
-        if (strcmp(prev_material, labels[record].material) != 0) {
-
-            // new material record
-            fprintf(fpout, "Z2BTMH01000");
-            print_spaces(fpout, 19);
-            fprintf(fpout, "500000000000");
-            // cols 22-29 - 7 digit control number?
-            fprintf(fpout, "%s", idoc->ctrl_num);
-            fprintf(fpout, "%06d", sequence_number);
-
-            // every NEW material number carries over the sequence_number
-            idoc->matl_seq_number = sequence_number - 1;
-            idoc->labl_seq_number = sequence_number;
-            fprintf(fpout, "%06d", idoc->matl_seq_number);
-            sequence_number++;
-
-            fprintf(fpout, MATERIAL_REC);
-            fprintf(fpout, "%-18s", labels[record].material);
-            fprintf(fpout, "\n");
-            strlcpy(prev_material, labels[record].material, LRG);
-        }
-    }
-    // LABEL record (required). If the contents of .label are not "LBL", program aborts.
-    char graphic_val_shrt[4] = {0};
-    strncpy(graphic_val_shrt, labels[record].label, 3);
-    if (strcmp(graphic_val_shrt, "LBL") != 0) {
-        printf("The first 3 characters of the record are not \"LBL\", record %d.\n", record);
-        return 0;
-    } else {
-        fprintf(fpout, "Z2BTLH01000");
+    if ((strlen(label->material) > 0) && (strcmp(idoc->prev_material, label->material) != 0)) {
+
+        // new material record
+        fprintf(fpout, "Z2BTMH01000");
         print_spaces(fpout, 19);
         fprintf(fpout, "500000000000");
-
         // cols 22-29 - 7 digit control number?
         fprintf(fpout, "%s", idoc->ctrl_num);
-        fprintf(fpout, "%06d", sequence_number);
-        fprintf(fpout, "%06d", idoc->labl_seq_number);
-        idoc->tdline_seq_number = sequence_number;
-        idoc->char_seq_number = sequence_number;
-        sequence_number++;
-        fprintf(fpout, LABEL_REC);
-        fprintf(fpout, "%-18s", labels[record].label);
-        fprintf(fpout, "\n");
-    }
+        fprintf(fpout, "%06d", idoc->sequence_number);
 
-    // TDLINE record(s) (optional) - repeat as many times as there are "##"
+        // every NEW material number carries over the sequence_number
+        idoc->matl_seq_number = idoc->sequence_number - 1;
+        idoc->labl_seq_number = idoc->sequence_number;
+        fprintf(fpout, "%06d", idoc->matl_seq_number);
+        idoc->sequence_number++;
 
-    memcpy(graphic_val, labels[record].tdline, 4);
-
-    if ((strlen(graphic_val) > 0) &&
-        (strcasecmp(graphic_val, "n/a") != 0) &&
-        (strcasecmp(graphic_val, "N") != 0)) {
+        fprintf(fpout, MATERIAL_REC);
+        fprintf(fpout, "%-18s", label->material);
+        fprintf(fpout, "\n");
+        strlcpy(idoc->prev_material, label->material, sizeof(idoc->prev_material));
+    }
+}
 
-        //* get the first token *//*
-        int tdline_count = 0;
+/**
+    prints the LABEL record. If the label does not start with "LBL" the
+    record is rejected.
+    @param fpout points to the output file
+    @param label is the label record being processed
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+    @return true if the record was printed
+*/
+int print_label_record(FILE *fpout, const Label_record *label, int record, Ctrl *idoc) {
 
-        char *token = labels[record].tdline;
+    if (strncmp(label->label, "LBL", 3) != 0) {
+        if (idoc->variant->report)
+            printf("The first 3 characters of the record are not \"LBL\", record %d.\n", record);
+        return 0;
+    }
 
-        //check for and remove any leading...
-        if (token[0] == '\"')
-            memmove(token, token + 1, (int) strlen(token));
+    fprintf(fpout, "Z2BTLH01000");
+    print_spaces(fpout, 19);
+    fprintf(fpout, "500000000000");
 
-        // ...and/or trailing quotes
-        if (token[(int) strlen(token) - 1] == '\"')
-            token[(int) strlen(token) - 1] = '\0';
+    // cols 22-29 - 7 digit control number?
+    fprintf(fpout, "%s", idoc->ctrl_num);
+    fprintf(fpout, "%06d", idoc->sequence_number);
+    fprintf(fpout, "%06d", idoc->labl_seq_number);
+    idoc->tdline_seq_number = idoc->sequence_number;
+    idoc->char_seq_number = idoc->sequence_number;
+    idoc->sequence_number++;
+    fprintf(fpout, LABEL_REC);
+    fprintf(fpout, "%-18s", label->label);
+    fprintf(fpout, "\n");
+    return 1;
+}
 
-        // and convert all instances of double quotes to single quotes
-        char *a;
-        while (a = strstr(token, "\"\""))
-            memmove(a, a + 1, (int) strlen(a));
+/**
+    prints one TDLINE record per "##"-delimited segment, split at ingest
+    @param fpout points to the output file
+    @param label is the label record being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+*/
+void print_tdline_records(FILE *fpout, const Label_record *label, Ctrl *idoc) {
 
-        while (strlen(token) > 0) {
-            fprintf(fpout, "Z2BTTX01000");
-            print_spaces(fpout, 19);
-            fprintf(fpout, "500000000000");
-            // cols 22-29 - 7 digit control number?
-            fprintf(fpout, "%s", idoc->ctrl_num);
-            fprintf(fpout, "%06d", sequence_number++);
-            fprintf(fpout, "%06d", idoc->tdline_seq_number);
-            fprintf(fpout, TDLINE_REC);
-            fprintf(fpout, "GRUNE  ENMATERIAL  ");
-            fprintf(fpout, "%s", labels[record].label);
-            print_spaces(fpout, TDLINE_INDENT);
+    for (int seg = 0; seg < label->tdline_count; seg++) {
+        fprintf(fpout, "Z2BTTX01000");
+        print_spaces(fpout, 19);
+        fprintf(fpout, "500000000000");
+        // cols 22-29 - 7 digit control number?
+        fprintf(fpout, "%s", idoc->ctrl_num);
+        fprintf(fpout, "%06d", idoc->sequence_number++);
+        fprintf(fpout, "%06d", idoc->tdline_seq_number);
+        fprintf(fpout, TDLINE_REC);
+        fprintf(fpout, TDLINE_TAG);
+        fprintf(fpout, "%s", label->label);
+        print_spaces(fpout, TDLINE_INDENT);
+        fprintf(fpout, "%-74s", label->tdline_segments[seg]);
+        if (seg == 0)
+            fprintf(fpout, "*");
+        else
+            fprintf(fpout, "/");
+        fprintf(fpout, "\n");
+    }
+}
 
-            char *dpos = strstr(token, "##");
+/**
+    returns true if a revision is R0 - R99
+*/
+bool valid_revision(const char *value) {
 
-            if (dpos != NULL) {
-                *dpos = '\0';
-                fprintf(fpout, "%s", token);
-                fprintf(fpout, "##");
-                print_spaces(fpout, 70 - (int) (strlen(token) - 2));
+    int rev = 0;
+    return (sscanf(value, "R%d", &rev) == 1) && rev >= 0 && rev <= 99;
+}
 
-                // get the next segment of label record, after the "##"
-                token = dpos + (int) strlen("##");
-            } else {
-                fprintf(fpout, "%-74s", token);
-                token[0] = '\0';
-            }
-            if (tdline_count == 0)
-                fprintf(fpout, "*");
-            else
-                fprintf(fpout, "/");
-            tdline_count++;
-            fprintf(fpout, "\n");
-        }
-    }
+/**
+    prints the REVISION record if its value is R0 - R99, and reports it
+    otherwise
+    @param fpout points to the output file
+    @param field is the REVISION schema entry
+    @param value is the label's revision
+    @param tag is the revision's tag
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+*/
+void print_revision_record(FILE *fpout, const Field_def *field, const char *value, Cell_tag tag, int record,
+                           Ctrl *idoc) {
 
-    // TEMPLATENUMBER record (required)
-    if (labels[record].template) {
-        print_info_column_header(fpout, "TEMPLATENUMBER", labels[record].template, idoc);
-    } else {
-        printf("Missing template number in record %d. Aborting.\n", record);
-        return 0;
-    }
+    if (valid_revision(value))
+        print_info_column_header(fpout, field->column, value, tag, idoc);
+    else if (idoc->variant->report)
+        printf("Invalid revision value \"%s\" in record %d. %s record skipped.\n", value, record, field->column);
+}
 
-    // REVISION record (optional)
-    if (labels[record].revision) {
-        int rev = 0;
-        if ((sscanf(labels[record].revision, "R%d", &rev) == 1) && rev >= 0 && rev <= 99) {
-            print_info_column_header(fpout, "REVISION", labels[record].revision, idoc);
-        } else
-            printf("Invalid revision value \"%s\" in record %d. REVISION record skipped.\n",
-                   labels[record].revision, record);
-    }
+/**
+    prints an optional value record, which is skipped if the cell is blank
+    or "N". GTINs are validated first, and a value found in the SAP lookup
+    array is printed with its lookup value.
+    @param fpout points to the output file
+    @param field is the schema entry of the value
+    @param value is the label's value
+    @param tag is the value's tag
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+*/
+void print_value_record(FILE *fpout, const Field_def *field, const char *value, Cell_tag tag, int record,
+                        Ctrl *idoc) {
 
-    // SIZE record (optional)
-    memcpy(graphic_val, labels[record].size, MED);
+    if ((tag.length == 0) || (cell_class(tag) == CELL_NO))
+        return;
 
-    if ((strlen(labels[record].size) > 0) && (!equals_no(graphic_val))) {
-        char *token = labels[record].size;
+    if (field->store == STORE_GTIN)
+        validate_gtin(value, record, true, idoc);
 
-        //check for and remove any leading...
-        if (token[0] == '\"')
-            memmove(token, token + 1, strlen(token));
+    if (field->store == STORE_LOOKUP) {
+        char *gnp = sap_lookup(value);
 
-        // ...and/or trailing quotes
-        if (token[strlen(token) - 1] == '\"')
-            token[strlen(token) - 1] = '\0';
+        // a standard value not in the lookup array is reported, but still printed
+        if ((gnp == NULL) && (field->attrs & ATTR_STANDARD) && idoc->variant->report)
+            printf("%s value \"%s\" in record %d is not a standard %s value. Please check it.\n",
+                   field->column, value, record, field->column);
 
-        // and convert all instances of double quotes to single quotes
-        char *a;
-        int diff;
-        while ((a = strstr(token, "\"\"")) != NULL) {
-            diff = (int) (a - token);
-            memmove(token + diff, token + diff + 1, strlen(token) - 1);
+        if (gnp != NULL) {
+            print_info_lookup_column_header(fpout, field->column, value, gnp, idoc);
+            return;
         }
-
-        // size name will be checked against its SAP lookup value.
-        // just in case there's a matching entry...
-        char *gnp = sap_lookup(labels[record].size);
-        if (gnp != NULL)
-            print_info_lookup_column_header(fpout, "SIZE", labels[record].size, gnp, idoc);
-        else
-            print_info_column_header(fpout, "SIZE", labels[record].size, idoc);
     }
+    print_info_column_header(fpout, field->column, value, tag, idoc);
+}
 
-    /** LEVEL record (optional) */
+/**
+    writes a number as a fixed number of digits, zero-padded
+*/
+static void put_digits(char *dst, int number, int digits) {
 
-    if ((strlen(labels[record].level) > 0) && (!equals_no(labels[record].level))) {
+    for (int d = digits - 1; d >= 0; d--) {
+        dst[d] = (char) ('0' + number % 10);
+        number /= 10;
+    }
+}
 
-        // level name will be checked against its SAP lookup value.
-        // if it's not in there, it'll be reported as such. Otherwise, the  (but will not be changed).
-        char *gnp = sap_lookup(labels[record].level);
-        if (gnp == NULL)
-            printf("Level value \"%s\" in record %d is not a standard LEVEL value. Please check it.\n",
-                   labels[record].level, record);
+/**
+    prints a characteristic record from its cached text: the record prefix
+    is copied, its sequence numbers written into it, and the text appended
+    @param fpout points to the output file
+    @param cached is the record's cached text
+    @param idoc is a Ctrl structure containing sequence numbers
+*/
+void print_cached_record(FILE *fpout, const Record_entry *cached, Ctrl *idoc) {
 
-        print_info_lookup_column_header(fpout, "LEVEL", labels[record].level, gnp, idoc);
+    static const char head[] = "Z2BTLC01000                   500000000000";
+    char prefix[RECORD_PREFIX_LEN];
 
+    // past six digits the numbers are printed the long way, as their own width
+    if (idoc->sequence_number > MAX_SEQUENCE_NUMBER || idoc->char_seq_number > MAX_SEQUENCE_NUMBER) {
+        print_Z2BTLC01000(fpout, idoc);
+        fwrite(cached->body, 1, cached->length, fpout);
+        return;
     }
 
-    /** QUANTITY record (optional) */
-    if ((labels[record].quantity) && (!equals_no(labels[record].quantity))) {
-        print_info_column_header(fpout, "QUANTITY", labels[record].quantity, idoc);
-    }
+    memcpy(prefix, head, sizeof(head) - 1);
+    memcpy(prefix + sizeof(head) - 1, idoc->ctrl_num, CONTROL_NUMBER_LEN);
+    put_digits(prefix + sizeof(head) - 1 + CONTROL_NUMBER_LEN, idoc->sequence_number++, 6);
+    put_digits(prefix + sizeof(head) - 1 + CONTROL_NUMBER_LEN + 6, idoc->char_seq_number, 6);
+    memcpy(prefix + RECORD_PREFIX_LEN - 2, CHAR_REC, 2);
 
-    /** BARCODETEXT record (optional) */
-    char *endptr;
-    if ((strlen(labels[record].barcodetext) > 0) && (!equals_no(labels[record].barcodetext))) {
+    fwrite(prefix, 1, sizeof(prefix), fpout);
+    fwrite(cached->body, 1, cached->length, fpout);
+}
 
-        if (isNumeric(labels[record].barcodetext)) {
+/**
+    renders the text of a graphic record after its prefix, by printing the
+    record the uncached way to memory
+    @param entry receives the text
+    @param field is the schema entry of the graphic
+    @param value is the label's value
+    @param tag is the value's tag
+    @param v is a variant with the graphics path of the record
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int render_graphic_record(Record_entry *entry, const Field_def *field, const char *value, Cell_tag tag,
+                                 const Variant *v) {
+
+    Ctrl idoc = {DEFAULT_CONTROL_NUMBER, 0, 1, 0, 0, 1, {0}, v};
+    char *text = NULL;
+    size_t length = 0;
+    FILE *fp = open_memstream(&text, &length);
+
+    if (fp == NULL)
+        return -1;
+    if ((field->emit == EMIT_GS1) && (tag.kind & CELL_SPACE))
+        print_blank_graphic_column_header(fp, field->column, value, &idoc);
+    else
+        print_graphic_column_header(fp, field->column, value, tag, field->graphic, &idoc);
+    if (fclose(fp) != 0 || length < RECORD_PREFIX_LEN) {
+        free(text);
+        return -1;
+    }
 
-            // convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].barcodetext, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
+    memmove(text, text + RECORD_PREFIX_LEN, length - RECORD_PREFIX_LEN + 1);
+    entry->body = text;
+    entry->length = length - RECORD_PREFIX_LEN;
+    return 0;
+}
 
-            // 14-digit GTIN - verify the checkDigit
-            if ((strlen(labels[record].barcodetext) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].barcodetext, record);
+/**
+    renders every distinct graphic record the variants print for the
+    labels, once per column, value and graphics path, before the IDocs are
+    written. The cache is only read from then on, by any writer thread.
+    @param labels is the label records
+    @param variants is the variants to write
+    @param variant_count is the number of variants
+    @return 0 if successful, -1 if unsuccessful
+*/
+int cache_graphic_records(const Label_record *labels, const Variant *variants, int variant_count) {
+
+    if (record_cache_init(&graphic_records) != 0)
+        return -1;
+
+    for (int v = 0; v < variant_count; v++)
+        for (int i = 1; i < spreadsheet_row_number; i++)
+            for (int step = 0; step < variants[v].emit_plan_len; step++) {
+                const Field_def *field = variants[v].emit_plan[step];
+                if (field->emit != EMIT_GRAPHIC && field->emit != EMIT_GS1)
+                    continue;
+
+                // only the records print_graphic_record() prints are cached
+                const char *value = field_text(&labels[i], field);
+                Cell_tag tag = field_tag(&labels[i], field);
+                if (tag.length == 0 || strlen(value) >= MED ||
+                    (field->store == STORE_GTIN && cell_class(tag) == CELL_NO))
+                    continue;
+
+                bool found;
+                Record_entry *entry = record_cache_insert(&graphic_records, (int) (field - label_fields),
+                                                          variants[v].alt_path, value, &found);
+                if (entry == NULL || (!found && render_graphic_record(entry, field, value, tag, &variants[v]) != 0)) {
+                    record_cache_free(&graphic_records);
+                    return -1;
                 }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-            } else if (strlen(labels[record].barcodetext) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].barcodetext, record);
             }
+    return 0;
+}
 
-            // verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-            // verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
+/**
+    prints a graphic record. A GTIN graphic is validated first and left out
+    entirely if the cell is "N"; a GS1 value containing spaces is printed
+    with a blank graphic path.
+    @param fpout points to the output file
+    @param field is the schema entry of the graphic
+    @param value is the label's value
+    @param tag is the value's tag
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+*/
+void print_graphic_record(FILE *fpout, const Field_def *field, const char *value, Cell_tag tag, int record,
+                          Ctrl *idoc) {
 
-            // GTIN non-numeric so we'll report that it's non-numeric before printing.
-        } else {
-            printf("Nonnumeric GTIN \"%s\" in record %d. \n", labels[record].barcodetext, record);
-        }
-        print_info_column_header(fpout, "BARCODETEXT", labels[record].barcodetext, idoc);
-    }
-
-    /** GTIN record (optional) - this is a non-SAP field that prints only if [-n] flag is present at runtime */
-    if (labels[record].gtin) {
-        if (non_SAP_fields) {
-            char gtin_digit1[2] = {0};
-            strncpy(gtin_digit1, labels[record].gtin, 1);
-
-            if ((strlen(labels[record].gtin) > 0) && (!equals_no(labels[record].gtin))) {
-
-                if (isNumeric(labels[record].gtin)) {
-
-                    // convert string to long long integer to verify GTIN length and check digit
-                    long long gtin = strtoll(labels[record].gtin, &endptr, 10);
-                    int gtin_ctry_prefix;
-                    int gtin_cpny_prefix;
-
-                    // 14-digit GTIN - verify the checkDigit
-                    if ((strlen(labels[record].gtin) == GTIN_13 + 1)) {
-                        if (gtin % 10 != checkDigit(&gtin)) {
-                            printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].gtin, record);
-                        }
-                        gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-                    } else if (strlen(labels[record].gtin) == GTIN_13) {
-                        gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-                    } else {
-                        printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].gtin,
-                               record);
-                    }
-
-                    // verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-                    // verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-                    if ((gtin_ctry_prefix > 4) ||
-                        (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                        printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
-
-                    // GTIN non-numeric so we'll report that it's non-numeric before printing.
-                } else {
-                    printf("Nonnumeric GTIN \"%s\" in record %d. \n", labels[record].gtin, record);
-                }
-                print_info_column_header(fpout, "GTIN", labels[record].gtin, idoc);
-            }
-        }
+    if (field->store == STORE_GTIN) {
+        if (cell_class(tag) == CELL_NO)
+            return;
+        validate_gtin(value, record, false, idoc);
     }
-    // LTNUMBER record (optional)
-    if (labels[record].ltnumber) {
-        print_info_column_header(fpout, "LTNUMBER", labels[record].ltnumber, idoc);
-    }
-
-    // IPN record (optional) - - this is a non-SAP field that prints only if [-n] flag is present at runtime */
-    if (non_SAP_fields)
-        if (labels[record].ipn) {
-            print_info_column_header(fpout, "IPN", labels[record].ipn, idoc);
-        }
 
-    //
-    // GRAPHIC01 - GRAPHIC14 Fields (optional)
-    // If the cell value is "Y" or "YES', a corresponding record is printed.
-    //
-    int g_cnt = 1;
-    print_graphic0x_record(fpout, &g_cnt, F_ "Caution.tif", labels[record].caution, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "ConsultIFU.tif", labels[record].consultifu, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "Latex.tif", labels[record].latex, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "DoNotUsePakDam.tif", labels[record].donotusedamaged, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "Latex Free.tif", labels[record].latexfree, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "ManInBox.tif", labels[record].maninbox, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "DoNotRe-sterilize.tif", labels[record].noresterilize, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "Non-sterile.tif", labels[record].nonsterile, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "PVC_Free.tif", labels[record].pvcfree, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "REUSABLE.tif", labels[record].reusable, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "Singleuse.tif", labels[record].singleuseonly, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "SINGLEPATIENUSE.tif", labels[record].singlepatientuse, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "ElectroSurIFU.tif", labels[record].electroifu, idoc);
-    print_graphic0x_record(fpout, &g_cnt, F_ "KeepDry.tif", labels[record].keepdry, idoc);
-    //
-    // END of GRAPHIC01 - GRAPHIC14 Fields (optional)
-    //
-
-    /** BARCODE1 record (optional) */
-    if ((labels[record].barcode1) && (!equals_no(labels[record].barcode1))) {
-
-        if (isNumeric(labels[record].barcode1)) {
-
-            // convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].barcode1, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
-
-            // 14-digit GTIN - verify the checkDigit
-            if ((strlen(labels[record].barcode1) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].barcode1, record);
-                }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
+    // a record rendered before is copied, with only its sequence numbers written
+    const Record_entry *cached = record_cache_find(&graphic_records, (int) (field - label_fields),
+                                                   idoc->variant->alt_path, value);
+    if (cached != NULL)
+        print_cached_record(fpout, cached, idoc);
+    else if ((field->emit == EMIT_GS1) && (tag.kind & CELL_SPACE))
+        print_blank_graphic_column_header(fpout, field->column, value, idoc);
+    else
+        print_graphic_column_header(fpout, field->column, value, tag, field->graphic, idoc);
+}
 
-            } else if (strlen(labels[record].barcode1) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].barcode1, record);
-            }
+/**
+    prints the remaining IDoc records based on the number
+    of label records. The records follow the variant's emit plan, built
+    by init_variant() from the LABEL_FIELDS schema.
+    @param fpout points to the output file
+    @param labels is the array of label records
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+    @return true if a label_idoc_record was printed successfully
+*/
+int print_label_idoc_records(FILE *fpout, Label_record *labels, int record, Ctrl *idoc) {
 
-            // verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-            // verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
+    const Label_record *label = &labels[record];
+
+    for (int step = 0; step < idoc->variant->emit_plan_len; step++) {
+        const Field_def *field = idoc->variant->emit_plan[step];
+
+        switch (field->emit) {
+            case EMIT_MATERIAL:
+                print_material_record(fpout, label, idoc);
+                break;
+            case EMIT_LABEL:
+                if (!print_label_record(fpout, label, record, idoc))
+                    return 0;
+                break;
+            case EMIT_TDLINE:
+                print_tdline_records(fpout, label, idoc);
+                break;
+            case EMIT_INFO:
+                print_info_column_header(fpout, field->column, field_text(label, field), field_tag(label, field), idoc);
+                break;
+            case EMIT_VALUE:
+                print_value_record(fpout, field, field_text(label, field), field_tag(label, field), record, idoc);
+                break;
+            case EMIT_REVISION:
+                print_revision_record(fpout, field, field_text(label, field), field_tag(label, field), record, idoc);
+                break;
+            case EMIT_GRAPHIC0X:
+                print_graphic0x_records(fpout, label->flags, idoc);
+                break;
+            case EMIT_BOOLEAN:
+                print_boolean_records(fpout, label->flags, idoc);
+                break;
+            case EMIT_BOOLEAN_HEADER:
+                print_boolean_column_header(fpout, field, label->flags, idoc);
+                break;
+            case EMIT_GRAPHIC:
+            case EMIT_GS1:
+                print_graphic_record(fpout, field, field_text(label, field), field_tag(label, field), record, idoc);
+                break;
         }
-        print_graphic_column_header(fpout, "BARCODE1", labels[record].barcode1, "Nothing", idoc);
     }
+    return 1;
+}
 
-    /** GS1 record (optional) */
+/**
+    returns a field's printed width: its length, padded to at least width
+*/
+static size_t padded(size_t length, size_t width) {
+    return length > width ? length : width;
+}
 
-    if ((labels[record].gs1) && (!equals_no(labels[record].gs1))) {
+/**
+    returns the number of characters print_graphic_path() prints
+*/
+size_t graphic_path_size(const char *graphic, const Ctrl *idoc) {
 
-        char *endptr;
-        if (isNumeric(labels[record].gs1)) {
+    size_t path = strlen(idoc->variant->alt_path ? ALT_GRAPHICS_PATH : GRAPHICS_PATH);
+    int n = GRAPHIC_PATH_LEN - ((int) path + (int) strnlen(graphic, MED + 1));
 
-            // convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].gs1, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
+    return path + strlen(graphic) + (n > 0 ? (size_t) n : 0);
+}
 
-            // 14-digit GTIN - verify the checkDigit
-            if ((strlen(labels[record].gs1) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].gs1, record);
-                }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
+/**
+    returns the size of a characteristic record printed by
+    print_info_column_header(), or 0 if it prints none
+*/
+size_t info_record_size(const char *col_name, Cell_tag tag) {
 
-            } else if (strlen(labels[record].gs1) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].gs1, record);
-            }
+    if (tag.length == 0)
+        return 0;
 
-            // verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-            // verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
-        }
+    // a "N" cell is printed as "NO"
+    size_t length = (cell_class(tag) == CELL_NO) ? 2 : tag.length;
+    return RECORD_PREFIX_LEN + padded(strlen(col_name), CHAR_COL_LEN) +
+           padded(length, CHAR_COL_LEN) + padded(length, GRAPHIC_PATH_LEN) + 1;
+}
 
-        // if the GS1 field contains any spaces, just print the column heading, but no value
-        if (containsSpaces(labels[record].gs1))
-            print_blank_graphic_column_header(fpout, "GS1", labels[record].gs1, idoc);
-        else
-            print_graphic_column_header(fpout, "GS1", labels[record].gs1, "GS1", idoc);
-    }
-
-    print_boolean_record(fpout, "ECREP", labels[record].ecrep, F_ "EC Rep.tif", idoc);
-    print_boolean_record(fpout, "EXPDATE", labels[record].expdate, F_ "Expiration Date.tif", idoc);
-    print_boolean_record(fpout, "KEEPAWAYHEAT", labels[record].keepawayheat, F_ "KeepAwayHeat.tif", idoc);
-    print_boolean_record(fpout, "LOTGRAPHIC", labels[record].lotgraphic, F_ "Lot.tif", idoc);
-    print_boolean_record(fpout, "MANUFACTURER", labels[record].manufacturer, F_ "Manufacturer.tif", idoc);
-    print_boolean_record(fpout, "MFGDATE", labels[record].mfgdate, F_ "DateofManufacture.tif", idoc);
-    print_boolean_record(fpout, "PHTDEHP", labels[record].phtdehp, "PHT-DEHP.tif", idoc);
-    print_boolean_record(fpout, "PHTBBP", labels[record].phtbbp, F_ "PHT-BBP.tif", idoc);
-    print_boolean_record(fpout, "PHTDINP", labels[record].phtdinp, F_ "PHT-DINP.tif", idoc);
-    print_boolean_record(fpout, "REFNUMBER", labels[record].refnumber, F_ "REF.tif", idoc);
-    print_boolean_record(fpout, "REF", labels[record].ref, F_ "REF.tif", idoc);
-    print_boolean_record(fpout, "RXONLY", labels[record].rxonly, F_ "RX Only.tif", idoc);
-    print_boolean_record(fpout, "SERIAL", labels[record].serial, F_ "Serial Number.tif", idoc);
-    print_boolean_record(fpout, "TFXLOGO", labels[record].tfxlogo, F_ "TeleflexMedical.tif", idoc);
-
-    print_boolean_column_header(fpout, "SIZELOGO", labels[record].sizelogo, idoc);
-
-    print_graphic_column_header(fpout, "ADDRESS", labels[record].address, "Nothing", idoc);
-    print_graphic_column_header(fpout, "CAUTIONSTATE", labels[record].cautionstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout, "CE0120", labels[record].cemark, "Nothing", idoc);
-    print_graphic_column_header(fpout, "COOSTATE", labels[record].coostate, "Nothing", idoc);
-    print_graphic_column_header(fpout, "DISTRIBUTEDBY", labels[record].distby, "Nothing", idoc);
-    print_graphic_column_header(fpout, "ECREPADDRESS", labels[record].ecrepaddress, "Nothing", idoc);
-    print_graphic_column_header(fpout, "FLGRAPHIC", labels[record].flgraphic, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LABELGRAPH1", labels[record].labelgraph1, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LABELGRAPH2", labels[record].labelgraph2, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LATEXSTATEMENT", labels[record].latexstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LOGO1", labels[record].logo1, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LOGO2", labels[record].logo2, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LOGO3", labels[record].logo3, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LOGO4", labels[record].logo4, "Nothing", idoc);
-    print_graphic_column_header(fpout, "LOGO5", labels[record].logo5, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MDR1", labels[record].mdr1, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MDR2", labels[record].mdr2, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MDR3", labels[record].mdr3, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MDR4", labels[record].mdr4, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MDR5", labels[record].mdr5, "Nothing", idoc);
-    print_graphic_column_header(fpout, "MANUFACTUREDBY", labels[record].manufacturedby, "Nothing", idoc);
-    print_graphic_column_header(fpout, "PATENTSTA", labels[record].patentstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout, "STERILESTA", labels[record].sterilitystatement, "Nothing", idoc);
-    print_graphic_column_header(fpout, "STERILITYTYPE", labels[record].sterilitytype, "blank-01.txt", idoc);
-    print_graphic_column_header(fpout, "TEMPRANGE", labels[record].temprange, "Nothing", idoc);
-    print_graphic_column_header(fpout, "VERSION", labels[record].version, "Nothing", idoc);
-    print_graphic_column_header(fpout, "INSERTGRAPHIC", labels[record].insertgraphic, "yes", idoc);
-
-
-
-
-
-    if (non_SAP_fields) {
-        print_info_column_header(fpout, "OLDLABEL", labels[record].oldlabel, idoc);
-        print_info_column_header(fpout, "OLDTEMPLATE", labels[record].oldtemplate, idoc);
-        print_info_column_header(fpout, "PREVLABEL", labels[record].prevlabel, idoc);
-        print_info_column_header(fpout, "PREVTEMPLATE", labels[record].prevtemplate, idoc);
-        print_info_column_header(fpout, "BOMLEVEL", labels[record].bomlevel, idoc);
-
-        // DESCRIPTION record (optional)
-
-        //check for and remove any leading...
-        if (labels[record].description[0] == '\"')
-            memmove(labels[record].description, labels[record].description + 1,
-                    (int) strlen(labels[record].description));
-
-        // ...and/or trailing quotes
-        if (labels[record].description[(int) strlen(labels[record].description) - 1] == '\"')
-            labels[record].description[(int) strlen(labels[record].description) - 1] = '\0';
-
-        print_info_column_header(fpout, "DESCRIPTION", labels[record].description, idoc);
+/**
+    returns the size of the graphic record print_graphic_record() prints,
+    or 0 if it prints none
+*/
+size_t graphic_record_size(const Field_def *field, const char *value, Cell_tag tag, const Ctrl *idoc) {
+
+    const Record_entry *cached = record_cache_find(&graphic_records, (int) (field - label_fields),
+                                                   idoc->variant->alt_path, value);
+    if (cached != NULL)
+        return RECORD_PREFIX_LEN + cached->length;
+
+    size_t size = RECORD_PREFIX_LEN + padded(strlen(field->column), CHAR_COL_LEN) +
+                  padded(tag.length, CHAR_COL_LEN) + 1;
+
+    if ((field->store == STORE_GTIN) && (cell_class(tag) == CELL_NO))
+        return 0;
+    if ((field->emit == EMIT_GS1) && (tag.kind & CELL_SPACE))
+        return size + graphic_path_size("", idoc);
+    if (tag.length == 0)
+        return 0;
+
+    if (cell_class(tag) == CELL_YES)
+        return size + graphic_path_size(field->graphic, idoc);
+    if (cell_class(tag) == CELL_NO)
+        return size + graphic_path_size("blank-01.tif", idoc);
+
+    char *gnp = sap_lookup(value);
+    char graphic_name[LRG + SML];
+    snprintf(graphic_name, sizeof(graphic_name), "%s.tif", gnp ? gnp : value);
+    return size + graphic_path_size(graphic_name, idoc);
+}
+
+/**
+    computes the size of the records print_label_idoc_records() prints for
+    a label, without printing them. Like printing, it advances the sequence
+    numbers and updates the previous material in idoc, so the labels must be
+    sized in the order they are printed, and idoc ends up as printing the
+    label would leave it. The sequence numbers are assumed to fit in six
+    digits.
+    @param label is the label record to size
+    @param idoc is a Ctrl structure for the variant being sized
+    @return the number of bytes the label's records take up
+*/
+size_t label_idoc_size(const Label_record *label, Ctrl *idoc) {
+
+    size_t size = 0;
+
+    for (int step = 0; step < idoc->variant->emit_plan_len; step++) {
+        const Field_def *field = idoc->variant->emit_plan[step];
+        const char *value = (field->store == STORE_FLAG || field->store == STORE_TEXT) ?
+                            NULL : field_text(label, field);
+        Cell_tag tag = (value != NULL) ? field_tag(label, field) : (Cell_tag) {CELL_EMPTY, 0};
+        size_t record = 0;
+        int n = 1;
+
+        switch (field->emit) {
+            case EMIT_MATERIAL:
+                if ((strlen(label->material) > 0) && (strcmp(idoc->prev_material, label->material) != 0)) {
+                    record = RECORD_PREFIX_LEN + padded(strlen(label->material), KEY_LEN) + 1;
+                    idoc->matl_seq_number = idoc->sequence_number - 1;
+                    idoc->labl_seq_number = idoc->sequence_number;
+                    strlcpy(idoc->prev_material, label->material, sizeof(idoc->prev_material));
+                }
+                break;
+            case EMIT_LABEL:
+                record = RECORD_PREFIX_LEN + padded(strlen(label->label), KEY_LEN) + 1;
+                idoc->tdline_seq_number = idoc->sequence_number;
+                idoc->char_seq_number = idoc->sequence_number;
+                break;
+            case EMIT_TDLINE:
+                for (int seg = 0; seg < label->tdline_count; seg++) {
+                    size += RECORD_PREFIX_LEN + strlen(TDLINE_TAG) + strlen(label->label) + TDLINE_INDENT +
+                            padded(strlen(label->tdline_segments[seg]), TDLINE_LEN) + 2;
+                    idoc->sequence_number++;
+                }
+                break;
+            case EMIT_INFO:
+                record = info_record_size(field->column, tag);
+                break;
+            case EMIT_VALUE:
+                if ((tag.length > 0) && (cell_class(tag) != CELL_NO)) {
+                    char *gnp = (field->store == STORE_LOOKUP) ? sap_lookup(value) : NULL;
+                    if (gnp != NULL)
+                        record = RECORD_PREFIX_LEN + padded(strlen(field->column), CHAR_COL_LEN) +
+                                 padded(tag.length, CHAR_COL_LEN) + padded(strlen(gnp), GRAPHIC_PATH_LEN) + 1;
+                    else
+                        record = info_record_size(field->column, tag);
+                }
+                break;
+            case EMIT_REVISION:
+                if (valid_revision(value))
+                    record = info_record_size(field->column, tag);
+                break;
+            case EMIT_GRAPHIC0X:
+                n = __builtin_popcountll(label->flags & graphic0x_mask);
+                record = (size_t) n * FLAG_RECORD_LEN;
+                break;
+            case EMIT_BOOLEAN:
+                n = __builtin_popcountll((label->flags | (label->flags >> FLAG_WORD_BITS)) & boolean_mask);
+                record = (size_t) n * FLAG_RECORD_LEN;
+                break;
+            case EMIT_BOOLEAN_HEADER:
+                record = FLAG_RECORD_LEN;
+                break;
+            case EMIT_GRAPHIC:
+            case EMIT_GS1:
+                record = graphic_record_size(field, value, tag, idoc);
+                break;
+        }
+        if (record > 0) {
+            size += record;
+            idoc->sequence_number += n;
+        }
+    }
+    return size;
+}
+
+/**
+    returns the Ctrl structure a shard's IDoc starts with: its control
+    number, and sequence numbers and material starting over
+*/
+Ctrl start_ctrl(const Shard *shard) {
+
+    Ctrl idoc = {DEFAULT_CONTROL_NUMBER, 0, 1, 0, 0, 1, {0}, shard->variant};
+    strlcpy(idoc.ctrl_num, shard->ctrl_num, sizeof(idoc.ctrl_num));
+    return idoc;
+}
+
+/**
+    fills a label's sidecar index entry from the records printed for it
+    @param shard is the shard the label is in, with its index allocated
+    @param row is the label's row
+    @param offset is where the label's records start in the IDoc
+    @param length is the number of bytes printed for the label
+    @param first_seq is the label's first sequence number
+    @param idoc holds the sequence numbers and material after the label
+    @return where the next label's records start
+*/
+long index_label(const Shard *shard, int row, long offset, long length, int first_seq, const Ctrl *idoc) {
+
+    Index_entry *entry = &shard->index[row - shard->first];
+
+    entry->offset = offset;
+    entry->length = length;
+    entry->first_seq = first_seq;
+    entry->last_seq = idoc->sequence_number - 1;
+    strlcpy(entry->material, idoc->prev_material, sizeof(entry->material));
+    return offset + length;
+}
+
+/**
+    fills the sidecar index entries of the labels a resumed shard wrote
+    before its checkpoint, by sizing their records again
+    @param shard is the shard, with its index allocated
+    @param row is the last label row written before the checkpoint
+    @param offset is the IDoc's length at the checkpoint
+    @return 0 if the labels' records add up to offset, -1 if they do not
+*/
+int index_written_labels(const Shard *shard, int row, long offset) {
+
+    Ctrl sizing = start_ctrl(shard);
+    long index_offset = CONTROL_RECORD_LEN;
+
+    for (int i = shard->first; i <= row; i++) {
+        int first_seq = sizing.sequence_number;
+        long length = (long) label_idoc_size(&shard->variant->labels[i], &sizing);
+        index_offset = index_label(shard, i, index_offset, length, first_seq, &sizing);
+    }
+    return (index_offset == offset) ? 0 : -1;
+}
+
+/**
+    writes a shard's sidecar index: one fixed-width line per label, in label
+    order, giving where the label's records are in the IDoc, their first and
+    last sequence numbers and the label's material. A compressed IDoc's
+    offsets count uncompressed bytes.
+    @param shard is the shard, written successfully with its index filled
+    @return 0 if successful, -1 if unsuccessful
+*/
+int write_index(const Shard *shard) {
+
+    char *name = (char *) malloc(strlen(shard->outputfile) + strlen(INDEX_EXT) + 1);
+    FILE *fp;
+    int rc = 0;
+
+    if (name == NULL)
+        return -1;
+    sprintf(name, "%s%s", shard->outputfile, INDEX_EXT);
+    if ((fp = fopen(name, "w")) == NULL) {
+        printf("Could not open index file %s\n", name);
+        free(name);
+        return -1;
+    }
+
+    for (int row = shard->first; row < shard->last; row++) {
+        const Index_entry *entry = &shard->index[row - shard->first];
+        fprintf(fp, INDEX_FORMAT, INDEX_LABEL_LEN, shard->variant->labels[row].label, entry->offset,
+                entry->length, entry->first_seq, entry->last_seq, INDEX_MATERIAL_LEN, entry->material);
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Could not write index file %s\n", name);
+        rc = -1;
+    }
+    free(name);
+    return rc;
+}
+
+/**
+    reads the label of the nth line of an index file
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int read_index_label(int fd, long n, char *label) {
+
+    if (pread(fd, label, INDEX_LABEL_LEN, (off_t) (n * INDEX_ENTRY_LEN)) != INDEX_LABEL_LEN)
+        return -1;
+    label[INDEX_LABEL_LEN] = '\0';
+    label[strcspn(label, " ")] = '\0';
+    return 0;
+}
+
+/**
+    prints the records of the given labels from an IDoc, finding them with
+    a binary search of the IDoc's sidecar index rather than a scan of the
+    IDoc. Implements "idoc --extract IDoc.txt LBL..."; the records are
+    printed to stdout and any problems to stderr.
+    @param argc is the number of arguments after --extract
+    @param argv holds the IDoc file name and the labels
+    @return EXIT_SUCCESS if every label was found, EXIT_FAILURE otherwise
+*/
+int extract_labels(int argc, char *argv[]) {
+
+    char *name;
+    int idoc_fd, index_fd;
+    struct stat st;
+    int status = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: idoc --extract IDoc.txt LBL...\n");
+        return EXIT_FAILURE;
+    }
+    if ((name = (char *) malloc(strlen(argv[0]) + strlen(INDEX_EXT) + 1)) == NULL)
+        return EXIT_FAILURE;
+    sprintf(name, "%s%s", argv[0], INDEX_EXT);
+
+    if ((idoc_fd = open(argv[0], O_RDONLY)) < 0) {
+        fprintf(stderr, "File not found.\n");
+        free(name);
+        return EXIT_FAILURE;
+    }
+    if ((index_fd = open(name, O_RDONLY)) < 0 || fstat(index_fd, &st) != 0) {
+        fprintf(stderr, "Index file %s not found. Write the IDoc with -I to index it.\n", name);
+        close(idoc_fd);
+        free(name);
+        return EXIT_FAILURE;
+    }
+    free(name);
+
+    long entries = (long) st.st_size / INDEX_ENTRY_LEN;
+    char line[INDEX_ENTRY_LEN + 1];
+    char label[INDEX_LABEL_LEN + 1];
+
+    for (int arg = 1; arg < argc; arg++) {
+
+        // find the first entry that is not before the label
+        long lo = 0, hi = entries;
+        while (lo < hi) {
+            long mid = lo + (hi - lo) / 2;
+            if (read_index_label(index_fd, mid, label) != 0)
+                break;
+            if (strcmp(label, argv[arg]) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        // a duplicated label has an entry for each of its rows
+        bool found = false;
+        for (long n = lo; n < entries; n++) {
+            long offset, length;
+
+            if ((read_index_label(index_fd, n, label) != 0) || (strcmp(label, argv[arg]) != 0))
+                break;
+            if (pread(index_fd, line, INDEX_ENTRY_LEN, (off_t) (n * INDEX_ENTRY_LEN)) != INDEX_ENTRY_LEN)
+                break;
+            line[INDEX_ENTRY_LEN] = '\0';
+            if ((sscanf(line + INDEX_LABEL_LEN, "%ld %ld", &offset, &length) != 2))
+                break;
+
+            char *records = (char *) malloc((size_t) length);
+            if ((records == NULL) || (pread(idoc_fd, records, (size_t) length, (off_t) offset) != length)) {
+                fprintf(stderr, "Could not read label %s from %s\n", argv[arg], argv[0]);
+                free(records);
+                status = EXIT_FAILURE;
+                break;
+            }
+            fwrite(records, 1, (size_t) length, stdout);
+            free(records);
+            found = true;
+        }
+        if (!found) {
+            fprintf(stderr, "Label %s not found in %s\n", argv[arg], argv[0]);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    close(index_fd);
+    close(idoc_fd);
+    return status;
+}
+
+/**
+    returns the name of a shard's checkpoint file, which the caller frees,
+    or NULL if memory runs out
+*/
+char *checkpoint_name(const Shard *shard) {
+
+    char *name = (char *) malloc(strlen(shard->outputfile) + strlen(CHECKPOINT_EXT) + 1);
+    if (name != NULL)
+        sprintf(name, "%s%s", shard->outputfile, CHECKPOINT_EXT);
+    return name;
+}
+
+/**
+    records that a shard's IDoc has been written up to and including a label,
+    and the variant options it was written with. The checkpoint is written
+    to a temporary file and renamed over the last one, so a run killed while
+    writing it leaves the last one intact.
+    @param name is the checkpoint file name
+    @param row is the last label row fully written
+    @param label is that row's label number
+    @param offset is the IDoc's length after that label
+    @param idoc holds the sequence numbers and material after that label
+    @return 0 if successful, -1 if unsuccessful
+*/
+int write_checkpoint(const char *name, int row, const char *label, long offset, const Ctrl *idoc) {
+
+    char *tmp = (char *) malloc(strlen(name) + strlen(TMP_EXT) + 1);
+    FILE *fp;
+    int rc = 0;
+
+    if (tmp == NULL)
+        return -1;
+    sprintf(tmp, "%s%s", name, TMP_EXT);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        free(tmp);
+        return -1;
+    }
+    fprintf(fp, "%d %s %ld %s %d %d %d %d %d %d %d\n%s\n", row, label, offset, idoc->ctrl_num,
+            idoc->matl_seq_number, idoc->labl_seq_number, idoc->tdline_seq_number,
+            idoc->char_seq_number, idoc->sequence_number, idoc->variant->alt_path,
+            idoc->variant->non_SAP_fields, idoc->prev_material);
+    if ((fclose(fp) != 0) || (rename(tmp, name) != 0))
+        rc = -1;
+    free(tmp);
+    return rc;
+}
+
+/**
+    reads a shard's checkpoint, checking that it was written for the same
+    labels and variant options, and that the IDoc is at least as long as it
+    records. The caller checks the control number.
+    @param name is the checkpoint file name
+    @param shard is the shard being resumed
+    @param row receives the last label row fully written
+    @param offset receives the IDoc's length after that label
+    @param idoc receives the sequence numbers and material after that label
+    @return 0 if successful, -1 if there is no checkpoint or it does not fit
+*/
+int read_checkpoint(const char *name, const Shard *shard, int *row, long *offset, Ctrl *idoc) {
+
+    char label[LRG];
+    char material[LRG + 1] = {0};
+    int alt_path, non_SAP_fields;
+    struct stat st;
+    FILE *fp;
+
+    if ((fp = fopen(name, "r")) == NULL)
+        return -1;
+
+    int n = fscanf(fp, "%d %40s %ld %7s %d %d %d %d %d %d %d", row, label, offset, idoc->ctrl_num,
+                   &idoc->matl_seq_number, &idoc->labl_seq_number, &idoc->tdline_seq_number,
+                   &idoc->char_seq_number, &idoc->sequence_number, &alt_path, &non_SAP_fields);
+
+    // the material, which may be blank, is on a line of its own
+    if ((n != 11) || (fgetc(fp) != '\n') || (fgets(material, sizeof(material), fp) == NULL)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    material[strcspn(material, "\n")] = '\0';
+    strlcpy(idoc->prev_material, material, sizeof(idoc->prev_material));
+
+    if ((*row < shard->first) || (*row >= shard->last) || (*offset < CONTROL_RECORD_LEN) ||
+        (strcmp(label, shard->variant->labels[*row].label) != 0) ||
+        (alt_path != shard->variant->alt_path) || (non_SAP_fields != shard->variant->non_SAP_fields))
+        return -1;
+
+    // an IDoc shorter than the checkpoint lost records it says were written
+    if ((stat(shard->outputfile, &st) != 0) || (st.st_size < (off_t) *offset))
+        return -1;
+    return 0;
+}
+
+/**
+    takes a shard's control number from its checkpoint, so an IDoc resumed
+    with -C keeps the number it was started with
+    @param shard is the shard, with its output file name set
+    @return 0 if the shard has a checkpoint that fits it, -1 otherwise
+*/
+int resume_ctrl_num(Shard *shard) {
+
+    char *checkpoint = checkpoint_name(shard);
+    Ctrl idoc = start_ctrl(shard);
+    int row;
+    long offset;
+    int rc = -1;
+
+    if ((checkpoint != NULL) && (read_checkpoint(checkpoint, shard, &row, &offset, &idoc) == 0)) {
+        strlcpy(shard->ctrl_num, idoc.ctrl_num, sizeof(shard->ctrl_num));
+        rc = 0;
+    }
+    free(checkpoint);
+    return rc;
+}
+
+/**
+    writes one shard through stdio: a complete IDoc of a run of a variant's
+    labels, with its own control record and sequence numbers starting over.
+    An uncompressed IDoc is checkpointed every CHECKPOINT_INTERVAL labels;
+    with --resume, it is continued from its checkpoint, if it has one. The
+    checkpoint is removed once the IDoc is complete.
+    @param shard is the shard to write
+    @return 0 if the IDoc was written successfully, -1 otherwise
+*/
+int write_shard(const Shard *shard) {
+
+    const Variant *v = shard->variant;
+    Ctrl idoc = start_ctrl(shard);
+    Stream out;
+    FILE *fpout;
+    char *checkpoint = compress_output ? NULL : checkpoint_name(shard);
+    int row = shard->first - 1;
+    long offset = 0;
+
+    if (resume_output && (checkpoint != NULL) &&
+        (read_checkpoint(checkpoint, shard, &row, &offset, &idoc) == 0) &&
+        (strcmp(idoc.ctrl_num, shard->ctrl_num) == 0) &&
+        ((shard->index == NULL) || (index_written_labels(shard, row, offset) == 0)) &&
+        (stream_reopen_output(&out, shard->outputfile, offset) == 0)) {
+        printf("Resuming IDoc file \"%s\" after label %s\n", shard->outputfile, v->labels[row].label);
+        fpout = out.fp;
+
+    } else {
+        if (resume_output && (checkpoint != NULL) && (access(checkpoint, F_OK) == 0))
+            printf("Checkpoint \"%s\" does not fit this run; writing \"%s\" from the start\n", checkpoint,
+                   shard->outputfile);
+        idoc = start_ctrl(shard);
+        row = shard->first - 1;
+
+        if (stream_open_output(&out, shard->outputfile, compress_output) != 0) {
+            printf("Could not open output file %s\n", shard->outputfile);
+            free(checkpoint);
+            return -1;
+        }
+        fpout = out.fp;
+
+        if (print_control_record(fpout, &idoc) != 0) {
+            stream_close(&out);
+            free(checkpoint);
+            return -1;
+        }
+    }
+
+    // an indexed label is printed to memory first, so its length is what was written
+    char *label_buffer = NULL;
+    size_t label_length = 0;
+    FILE *label_out = NULL;
+    long index_offset = offset;
+
+    if ((shard->index != NULL) && ((label_out = open_memstream(&label_buffer, &label_length)) == NULL)) {
+        printf("Could not allocate memory for output file %s\n", shard->outputfile);
+        stream_close(&out);
+        free(checkpoint);
+        return -1;
+    }
+    if (row < shard->first)
+        index_offset = CONTROL_RECORD_LEN;
+
+    for (int i = row + 1; i < shard->last; i++) {
+        int first_seq = idoc.sequence_number;
+        bool printed;
+
+        if (label_out == NULL) {
+            printed = print_label_idoc_records(fpout, v->labels, i, &idoc);
+        } else {
+            // the buffer is rewound for each label, so its length is the label's
+            rewind(label_out);
+            printed = print_label_idoc_records(label_out, v->labels, i, &idoc) && (fflush(label_out) == 0) &&
+                      (fwrite(label_buffer, 1, label_length, fpout) == label_length);
+            if (printed)
+                index_offset = index_label(shard, i, index_offset, (long) label_length, first_seq, &idoc);
+        }
+        if (!printed) {
+            if (v->report)
+                printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", i);
+            if (label_out != NULL)
+                fclose(label_out);
+            free(label_buffer);
+            stream_close(&out);
+            free(checkpoint);
+            return -1;
+        }
+
+        // a checkpoint is only as good as the records flushed before it
+        if ((checkpoint != NULL) && ((i - shard->first + 1) % CHECKPOINT_INTERVAL == 0) &&
+            ((fflush(fpout) != 0) || (write_checkpoint(checkpoint, i, v->labels[i].label, ftell(fpout), &idoc) != 0)))
+            printf("Could not write checkpoint file %s after label %s\n", checkpoint, v->labels[i].label);
+    }
+
+    if (label_out != NULL)
+        fclose(label_out);
+    free(label_buffer);
+
+    if (stream_close(&out) != 0) {
+        printf("Could not write output file %s\n", shard->outputfile);
+        free(checkpoint);
+        return -1;
+    }
+    if (checkpoint != NULL)
+        remove(checkpoint);
+    free(checkpoint);
+    return 0;
+}
+
+/**
+    writes all n bytes of buf to a file descriptor at an offset, retrying
+    short writes
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int pwrite_all(int fd, const char *buf, size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t written = pwrite(fd, buf, n, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        n -= (size_t) written;
+        offset += written;
+    }
+    return 0;
+}
+
+/**
+    renders a run of a preallocated shard's labels in memory and writes it
+    at the run's offset. The first run starts with the control record.
+    @param run is the run to write
+    @return 0 if the run was written successfully, -1 otherwise
+*/
+int write_preallocated_run(const Run *run) {
+
+    const Shard *shard = run->shard;
+    Ctrl idoc = run->start;
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *fpout;
+    int rc = -1;
+
+    if ((fpout = open_memstream(&buffer, &length)) == NULL) {
+        printf("Could not allocate memory for output file %s\n", shard->outputfile);
+        return -1;
+    }
+
+    if (run->offset == 0)
+        print_control_record(fpout, &idoc);
+
+    // the memory stream's position is the number of bytes rendered so far
+    long index_offset = (long) run->offset + ftell(fpout);
+    for (int i = run->first; i < run->last; i++) {
+        long start = ftell(fpout);
+        int first_seq = idoc.sequence_number;
+
+        if (!print_label_idoc_records(fpout, shard->variant->labels, i, &idoc)) {
+            if (shard->variant->report)
+                printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", i);
+            fclose(fpout);
+            free(buffer);
+            return -1;
+        }
+        if (shard->index != NULL)
+            index_offset = index_label(shard, i, index_offset, ftell(fpout) - start, first_seq, &idoc);
+    }
+
+    if (fclose(fpout) != 0)
+        printf("Could not allocate memory for output file %s\n", shard->outputfile);
+    else if (length != run->size)
+        printf("Output file %s is not the size it was computed to be.\n", shard->outputfile);
+    else if (pwrite_all(shard->fd, buffer, length, run->offset) != 0)
+        printf("Could not write output file %s\n", shard->outputfile);
+    else
+        rc = 0;
+
+    free(buffer);
+    return rc;
+}
+
+/** the runs of all shards and the next one a worker should write        */
+typedef struct {
+    Run *runs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} Run_queue;
+
+/**
+    thread body that writes runs from the queue until none are left
+    @param arg is the Run_queue
+*/
+void *run_worker(void *arg) {
+
+    Run_queue *queue = (Run_queue *) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int next = queue->next < queue->count ? queue->next++ : -1;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (next < 0)
+            return NULL;
+
+        Run *run = &queue->runs[next];
+        run->status = (run->offset < 0) ? write_shard(run->shard) : write_preallocated_run(run);
+    }
+}
+
+/**
+    appends a run to the array of runs
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int add_run(Run **runs, int *count, Run run) {
+
+    Run *temp = (Run *) realloc(*runs, (*count + 1) * sizeof(Run));
+    if (temp == NULL)
+        return -1;
+    *runs = temp;
+    (*runs)[(*count)++] = run;
+    return 0;
+}
+
+/**
+    splits a shard into the runs the workers write. A shard written through
+    stdio is one run. A preallocated shard is sized label by label, which
+    gives every run its offset and the sequence numbers it starts with; its
+    file is then created at its full size. Its runs are queued only once the
+    file is, and a file system that cannot preallocate gets a streamed run.
+    @param shard is the shard, with its output file name set
+    @param preallocate if true, the shard is cut into runs written at offsets
+    @param runs is appended with the shard's runs
+    @param count is the number of runs in the array, updated
+    @return 0 if successful, -1 if unsuccessful, with no runs appended
+*/
+int plan_runs(Shard *shard, bool preallocate, Run **runs, int *count) {
+
+    Ctrl scratch = start_ctrl(shard);
+    Ctrl start = scratch;
+    off_t offset = 0;
+    size_t size = CONTROL_RECORD_LEN;
+    int first = shard->first;
+    Run *planned = NULL;
+    int planned_count = 0;
+
+    if (!preallocate)
+        return add_run(runs, count, (Run) {shard, shard->first, shard->last, scratch, -1, 0, -1});
+
+    for (int i = shard->first; i <= shard->last; i++) {
+        if ((i == shard->last) || (size >= RUN_SIZE)) {
+            if ((i > first || offset == 0) &&
+                add_run(&planned, &planned_count, (Run) {shard, first, i, start, offset, size, -1}) != 0) {
+                printf("Could not allocate memory for output file %s\n", shard->outputfile);
+                free(planned);
+                return -1;
+            }
+            offset += (off_t) size;
+            size = 0;
+            start = scratch;
+            first = i;
+        }
+        if (i < shard->last)
+            size += label_idoc_size(&shard->variant->labels[i], &scratch);
+    }
+
+    if ((shard->fd = open(shard->outputfile, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        printf("Could not open output file %s\n", shard->outputfile);
+        free(planned);
+        return -1;
+    }
+    if ((errno = posix_fallocate(shard->fd, 0, offset)) != 0) {
+        int err = errno;
+
+        close(shard->fd);
+        shard->fd = -1;
+        free(planned);
+        if ((err == EOPNOTSUPP) || (err == EINVAL))
+            return plan_runs(shard, false, runs, count);
+        printf("Could not preallocate output file %s: %s\n", shard->outputfile, strerror(err));
+        return -1;
+    }
+
+    for (int r = 0; r < planned_count; r++)
+        if (add_run(runs, count, planned[r]) != 0) {
+            printf("Could not allocate memory for output file %s\n", shard->outputfile);
+            *count -= r;
+            close(shard->fd);
+            shard->fd = -1;
+            free(planned);
+            return -1;
+        }
+    free(planned);
+    return 0;
+}
+
+/**
+    splits a variant's labels into shards. A material group, the labels from
+    one MATERIAL record to the next, is never split: a new shard is started
+    before a group that would take the shard over its label or byte cap, or
+    before every group if by_material is set. A group that is over a cap by
+    itself gets a shard of its own. The byte cap counts uncompressed bytes.
+    Whatever the caps, a new shard is also started before a group whose
+    records would number past MAX_SEQUENCE_NUMBER, the most six digits hold.
+    @param v is the variant, with its emit plan built
+    @param max_labels is the most labels in a shard, or 0 for no cap
+    @param max_bytes is the most bytes in a shard, or 0 for no cap
+    @param by_material if true, each material group is a shard
+    @param shards is appended with the variant's shards
+    @param count is the number of shards in the array, updated
+    @return 0 if successful, -1 if a material group has too many records
+    for one IDoc or memory runs out
+*/
+int plan_shards(Variant *v, int max_labels, size_t max_bytes, bool by_material, Shard **shards, int *count) {
+
+    Ctrl scratch = {DEFAULT_CONTROL_NUMBER, 0, 1, 0, 0, 1, {0}, v};
+    int shard_labels = 0;
+    size_t shard_bytes = CONTROL_RECORD_LEN;
+    int shard_records = 0;
+    int group_start = 1;
+    size_t group_bytes = 0;
+    int group_sequence = scratch.sequence_number;
+    int first = 1;
+
+    for (int i = 1; i <= spreadsheet_row_number; i++) {
+        const Label_record *label = &v->labels[i];
+
+        // a group ends before a new MATERIAL record, and at the last label
+        if ((i == spreadsheet_row_number) ||
+            ((i > group_start) && (strlen(label->material) > 0) &&
+             (strcmp(label->material, scratch.prev_material) != 0))) {
+            int group_labels = i - group_start;
+            int group_records = scratch.sequence_number - group_sequence;
+
+            if (group_records > MAX_SEQUENCE_NUMBER) {
+                printf("Material \"%s\" needs %d IDoc records, more than the %d one IDoc can number. Aborting.\n",
+                       v->labels[group_start].material, group_records, MAX_SEQUENCE_NUMBER);
+                return -1;
+            }
+
+            if ((shard_labels > 0) &&
+                (by_material || (shard_records + group_records > MAX_SEQUENCE_NUMBER) ||
+                 (max_labels > 0 && shard_labels + group_labels > max_labels) ||
+                 (max_bytes > 0 && shard_bytes + group_bytes > max_bytes))) {
+                Shard *temp = (Shard *) realloc(*shards, (*count + 1) * sizeof(Shard));
+                if (temp == NULL) {
+                    printf("Could not allocate memory. Exiting\n");
+                    return -1;
+                }
+                *shards = temp;
+                (*shards)[(*count)++] = (Shard) {v, first, group_start, NULL, -1, {0}, NULL};
+                first = group_start;
+                shard_labels = 0;
+                shard_bytes = CONTROL_RECORD_LEN;
+                shard_records = 0;
+            }
+
+            if (v->report && ((max_labels > 0 && group_labels > max_labels) ||
+                              (max_bytes > 0 && CONTROL_RECORD_LEN + group_bytes > max_bytes)))
+                printf("Material \"%s\" does not fit in one IDoc file; it is written to a file of its own.\n",
+                       v->labels[group_start].material);
+
+            shard_labels += group_labels;
+            shard_bytes += group_bytes;
+            shard_records += group_records;
+            group_start = i;
+            group_bytes = 0;
+            group_sequence = scratch.sequence_number;
+        }
+        if (i < spreadsheet_row_number)
+            group_bytes += label_idoc_size(label, &scratch);
+    }
+
+    Shard *temp = (Shard *) realloc(*shards, (*count + 1) * sizeof(Shard));
+    if (temp == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        return -1;
+    }
+    *shards = temp;
+    (*shards)[(*count)++] = (Shard) {v, first, spreadsheet_row_number, NULL, -1, {0}, NULL};
+    return 0;
+}
+
+/**
+    reads a byte count with an optional K, M or G suffix, e.g. "50M"
+    @param text is the byte count
+    @param size receives the number of bytes
+    @return 0 if successful, -1 if the byte count is invalid
+*/
+int parse_size(const char *text, size_t *size) {
+
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+
+    if (end == text)
+        return -1;
+    switch (toupper((unsigned char) *end)) {
+        case 'G':
+            n *= 1024;
+            // fall through
+        case 'M':
+            n *= 1024;
+            // fall through
+        case 'K':
+            n *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*end != '\0' || n == 0)
+        return -1;
+    *size = (size_t) n;
+    return 0;
+}
+
+/**
+    reads the -V list of IDoc variants, e.g. "std,n,J,nJ". Each variant is
+    "std" or a combination of the letters n (non-SAP fields) and J
+    (alternate graphics path).
+    @param list is the comma-separated list
+    @param variants receives the variants' options
+    @return the number of variants, or -1 if the list is invalid
+*/
+int parse_variants(const char *list, Variant *variants) {
+
+    int count = 0;
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        bool alt = false, non_SAP = false, valid = len > 0;
+
+        if (len != 3 || strncmp(list, "std", 3) != 0) {
+            for (size_t i = 0; i < len; i++) {
+                if (list[i] == 'n' && !non_SAP)
+                    non_SAP = true;
+                else if (toupper((unsigned char) list[i]) == 'J' && !alt)
+                    alt = true;
+                else
+                    valid = false;
+            }
+        }
+        if (!valid) {
+            printf("Unknown IDoc variant \"%.*s\".\n", (int) len, list);
+            return -1;
+        }
+
+        // each combination is written once
+        bool duplicate = false;
+        for (int v = 0; v < count; v++)
+            if (variants[v].alt_path == alt && variants[v].non_SAP_fields == non_SAP)
+                duplicate = true;
+        if (!duplicate) {
+            variants[count].alt_path = alt;
+            variants[count].non_SAP_fields = non_SAP;
+            count++;
+        }
+
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+    return count;
+}
+
+/**
+    frees the spreadsheet rows read so far and empties the spreadsheet
+    array, keeping its capacity
+*/
+void clear_spreadsheet() {
+
+    for (int i = 0; i < spreadsheet_row_number; i++)
+        free(spreadsheet[i]);
+    spreadsheet_row_number = 0;
+    spreadsheet_width = 0;
+}
+
+/**
+    reads and parses the base version of a delta, keeping the label rows
+    that pass the filter and adding each label to a table with the hash of
+    its first row. A repeated row identical to the first is dropped; a
+    label whose rows differ is reported, and counts as changed.
+    The spreadsheet array is emptied again for the new version.
+    @param filename is the base spreadsheet
+    @param filter selects the base's label rows to compare
+    @param base receives the base's label records and table
+    @return 0 if successful, -1 if unsuccessful
+*/
+int load_delta_base(const char *filename, const Row_filter *filter, Delta_base *base) {
+
+    Stream in;
+    Label_record *labels = NULL;
+    int rc = -1;
+
+    printf("Reading delta base \"%s\"\n", filename);
+    if (stream_open_input(&in, filename) != 0) {
+        printf("File \"%s\" not found.\n", filename);
+        return -1;
+    }
+    read_spreadsheet(in.fp);
+    if (stream_close(&in) != 0)
+        printf("Could not decompress \"%s\". Aborting.\n", filename);
+
+    else if (spreadsheet_row_number == 0)
+        printf("\"%s\" is empty. Aborting.\n", filename);
+
+    else if (duplicate_column_names(spreadsheet[0]))
+        printf("Duplicate column names in \"%s\". Aborting.\n", filename);
+
+    else if (((labels = (Label_record *) calloc(spreadsheet_row_number, sizeof(Label_record))) == NULL) ||
+             (label_table_init(&base->table, spreadsheet_row_number) != 0))
+        printf("Could not allocate memory. Exiting\n");
+
+    else if (parse_spreadsheet(spreadsheet[0], labels) == -1)
+        printf("Aborting.\n");
+
+    else {
+        int kept = 1, collapsed = 0;
+
+        for (int i = 1; i < spreadsheet_row_number; i++) {
+            bool found;
+
+            if (row_filter_active(filter) && !row_matches(filter, labels[i].label, labels[i].material)) {
+                free(labels[i].tdline);
+                free(labels[i].tdline_segments);
+                continue;
+            }
+            Label_entry *entry = label_table_insert(&base->table, labels[i].label, &found);
+
+            if (!found) {
+                entry->hash = label_record_hash(&labels[i]);
+                entry->row = kept;
+                strlcpy(entry->material, labels[i].material, sizeof(entry->material));
+                labels[kept++] = labels[i];
+                continue;
+            }
+
+            // as in the new version, a repeated row is dropped only if every field equals the first row's
+            const Field_def *diffs[FIELD_COUNT];
+            int count = label_record_diff(&labels[entry->row], &labels[i], diffs);
+
+            if (count == 0)
+                collapsed++;
+            else {
+                printf("Label %s is repeated in delta base record %d with different", labels[i].label, i);
+                for (int d = 0; d < count; d++)
+                    printf("%s %s", d > 0 ? "," : "", diffs[d]->column);
+                printf(". It is converted as changed.\n");
+                entry->conflicting = true;
+            }
+            free(labels[i].tdline);
+            free(labels[i].tdline_segments);
+        }
+        if (collapsed > 0)
+            printf("Collapsed %d identical repeated label rows in \"%s\"\n", collapsed, filename);
+
+        base->labels = labels;
+        base->count = kept;
+        labels = NULL;
+        rc = 0;
+    }
+
+    for (int i = 1; labels != NULL && i < spreadsheet_row_number; i++) {
+        free(labels[i].tdline);
+        free(labels[i].tdline_segments);
+    }
+    free(labels);
+    clear_spreadsheet();
+    return rc;
+}
+
+/**
+    frees the base version of a delta: its label records and table
+*/
+void free_delta_base(Delta_base *base) {
+
+    for (int i = 1; base->labels != NULL && i < base->count; i++) {
+        free(base->labels[i].tdline);
+        free(base->labels[i].tdline_segments);
+    }
+    free(base->labels);
+    base->labels = NULL;
+    base->count = 0;
+    label_table_free(&base->table);
+}
+
+static int compare_entry_labels(const void *a, const void *b) {
+    return strcmp((*(const Label_entry **) a)->label, (*(const Label_entry **) b)->label);
+}
+
+/**
+    keeps only the label rows that are new or changed since the delta base,
+    each found with one lookup of its label, and writes a report of the
+    base's labels that are gone
+    @param labels is the new version's label records
+    @param base holds the base's labels
+    @param report is the file name of the deleted labels report
+    @return 0 if successful, -1 if the report could not be written
+*/
+int apply_delta(Label_record *labels, Delta_base *base, const char *report) {
+
+    Label_table *table = &base->table;
+    int kept = 1, added = 0, changed = 0, deleted = 0;
+
+    for (int i = 1; i < spreadsheet_row_number; i++) {
+        Label_entry *entry = label_table_find(table, labels[i].label);
+        const Field_def *diffs[FIELD_COUNT];
+
+        // the hash only rules a label out; equal hashes are confirmed field by field
+        bool keep = (entry == NULL) || entry->conflicting || (entry->hash != label_record_hash(&labels[i])) ||
+                    (label_record_diff(&base->labels[entry->row], &labels[i], diffs) != 0);
+
+        if (entry == NULL)
+            added++;
+        else {
+            entry->seen = true;
+            changed += keep;
+        }
+
+        if (keep) {
+            labels[kept] = labels[i];
+            spreadsheet[kept++] = spreadsheet[i];
+        } else {
+            free(labels[i].tdline);
+            free(labels[i].tdline_segments);
+            free(spreadsheet[i]);
+        }
+    }
+    int unchanged = spreadsheet_row_number - kept;
+    spreadsheet_row_number = kept;
+
+    // the deleted labels are reported in label order
+    Label_entry **gone = (Label_entry **) malloc((table->count + 1) * sizeof(Label_entry *));
+    FILE *fp = fopen(report, "w");
+    if (gone == NULL || fp == NULL) {
+        printf("Could not write deleted labels report %s\n", report);
+        free(gone);
+        if (fp != NULL)
+            fclose(fp);
+        return -1;
+    }
+    for (size_t e = 0; e < table->cap; e++)
+        if (table->entries[e].used && !table->entries[e].seen)
+            gone[deleted++] = &table->entries[e];
+    qsort(gone, (size_t) deleted, sizeof(Label_entry *), compare_entry_labels);
+
+    fprintf(fp, "LABEL\tMATERIAL\n");
+    for (int d = 0; d < deleted; d++)
+        fprintf(fp, "%s\t%s\n", gone[d]->label, gone[d]->material);
+    free(gone);
+
+    printf("Delta: %d new, %d changed, %d unchanged and %d deleted labels\n", added, changed, unchanged, deleted);
+    printf("Creating deleted labels report \"%s\"\n", report);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+    collapses repeated label rows with one table insert per row. A row
+    identical to the first row of its label is dropped; one that differs
+    is kept and reported with the columns that differ.
+    @param labels is the label records, compacted in place
+    @return the number of label rows dropped, or -1 if unsuccessful
+*/
+int collapse_duplicates(Label_record *labels) {
+
+    Label_table table;
+    int kept = 1, conflicts = 0;
+
+    if (label_table_init(&table, spreadsheet_row_number) != 0) {
+        printf("Could not allocate memory. Exiting\n");
+        return -1;
+    }
+
+    for (int i = 1; i < spreadsheet_row_number; i++) {
+        bool found;
+        Label_entry *entry = label_table_insert(&table, labels[i].label, &found);
+
+        if (!found) {
+            entry->row = kept;
+
+        } else {
+            // a row is dropped only if every field equals the first row's
+            const Field_def *diffs[FIELD_COUNT];
+            int count = label_record_diff(&labels[entry->row], &labels[i], diffs);
+
+            if (count == 0) {
+                free(labels[i].tdline);
+                free(labels[i].tdline_segments);
+                free(spreadsheet[i]);
+                continue;
+            }
+
+            printf("Label %s is repeated in record %d with different", labels[i].label, i);
+            for (int d = 0; d < count; d++)
+                printf("%s %s", d > 0 ? "," : "", diffs[d]->column);
+            printf(". Both rows are converted.\n");
+            conflicts++;
+        }
+        labels[kept] = labels[i];
+        spreadsheet[kept++] = spreadsheet[i];
     }
-    return 1;
+    label_table_free(&table);
+
+    int collapsed = spreadsheet_row_number - kept;
+    spreadsheet_row_number = kept;
+    if (collapsed > 0)
+        printf("Collapsed %d identical repeated label rows\n", collapsed);
+    if (conflicts > 0)
+        printf("%d repeated label rows differ from the first row of their label\n", conflicts);
+    return collapsed;
 }
 
-int main(int argc, char *argv[]) {
+/**
+    reads a spreadsheet into the spreadsheet array. With filters, only its
+    matching rows are kept.
+    @param filename is the spreadsheet, which may be gzip or zstd compressed
+    @param filter selects the label rows to keep
+    @return 0 if successful, -1 if unsuccessful
+*/
+int read_input(const char *filename, const Row_filter *filter) {
 
-    // elapsed time
-    clock_t start = clock();
+    Stream in;
 
-    // the Column_header struct that contains all spreadsheet col labels
-    // Column_header columns = {0};
+    // gzip and zstd compressed spreadsheets are decompressed as they are read
+    if (stream_open_input(&in, filename) != 0) {
+        printf("File \"%s\" not found.\n", filename);
+        return -1;
 
-    // the Label_record array
+    // with filters, only the matching rows of an uncompressed spreadsheet are read
+    } else if (row_filter_active(filter) && in.kind == STREAM_PLAIN) {
+        stream_close(&in);
+        if (read_filtered_spreadsheet(filename, filter) != 0) {
+            printf("Could not read \"%s\". Aborting.\n", filename);
+            return -1;
+        }
+    } else {
+        read_spreadsheet(in.fp);
+        if (stream_close(&in) != 0) {
+            printf("Could not decompress \"%s\". Aborting.\n", filename);
+            return -1;
+        }
+        if (row_filter_active(filter))
+            filter_spreadsheet_rows(filter);
+    }
+    return 0;
+}
+
+/** one of several spreadsheets merged into one IDoc                     */
+typedef struct {
+    const char *filename;
+    char **rows;
+    int row_count;
+    const Field_def **plan;
+    int column_count;
     Label_record *labels;
+    int status;
+} Input;
+
+/**
+    parses an input's rows with its own column plan and sorts them; run on
+    a thread of its own
+    @param arg is the Input
+    @return NULL
+*/
+void *parse_input(void *arg) {
+
+    Input *input = (Input *) arg;
+
+    input->status = parse_rows(input->plan, input->column_count, input->rows, input->row_count, input->labels);
+    if (input->status == 0)
+        sort_label_range(input->labels, 1, input->row_count);
+    return NULL;
+}
+
+/**
+    parses several spreadsheets, each with its own column headings, and
+    merges their label records into one array sorted by label number. The
+    inputs are parsed concurrently; each is sorted on its own thread and
+    the sorted inputs are then merged k ways. Their rows become the rows of
+    the spreadsheet array, under the first input's column headings.
+    @param inputs is the inputs, each with its rows read
+    @param count is the number of inputs
+    @param merged receives the merged label records
+    @return 0 if successful, -1 if unsuccessful
+*/
+int merge_inputs(Input *inputs, int count, Label_record **merged) {
+
+    int total = 1, status = 0;
+    pthread_t *threads = (pthread_t *) malloc(count * sizeof(pthread_t));
+    Label_record *parsed = NULL;
+
+    for (int k = 0; k < count; k++)
+        total += inputs[k].row_count - 1;
+
+    // the inputs' records are parsed side by side, each input's from labels[1]
+    if (threads == NULL ||
+        (parsed = (Label_record *) calloc(total, sizeof(Label_record))) == NULL ||
+        (*merged = (Label_record *) calloc(total, sizeof(Label_record))) == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        free(threads);
+        free(parsed);
+        return -1;
+    }
+
+    // the column plans are made one input at a time, so their messages stay in order
+    for (int k = 0, offset = 0; k < count && status == 0; k++) {
+        printf("Merging \"%s\"\n", inputs[k].filename);
+        if (duplicate_column_names(inputs[k].rows[0])) {
+            printf("Duplicate column names in \"%s\". Aborting.\n", inputs[k].filename);
+            status = -1;
+        } else if ((inputs[k].column_count = plan_columns(inputs[k].rows[0], &inputs[k].plan)) == -1) {
+            printf("Aborting.\n");
+            status = -1;
+        }
+        inputs[k].labels = parsed + offset;
+        offset += inputs[k].row_count - 1;
+    }
+
+    int started = 0;
+    for (; started < count && status == 0; started++)
+        if (pthread_create(&threads[started], NULL, parse_input, &inputs[started]) != 0) {
+            printf("Could not start a parsing thread. Exiting\n");
+            status = -1;
+            break;
+        }
+    for (int k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+        if (inputs[k].status != 0) {
+            printf("Could not allocate memory. Exiting\n");
+            status = -1;
+        }
+    }
+
+    // k-way merge: each record comes from the input whose next label is lowest
+    char **rows = (status == 0) ? (char **) malloc(total * sizeof(char *)) : NULL;
+    if (status == 0 && rows == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        status = -1;
+    }
+    if (status == 0) {
+        int *next = (int *) calloc(count, sizeof(int));
+        for (int k = 0; k < count; k++)
+            next[k] = 1;
+
+        for (int out = 1; out < total; out++) {
+            int lowest = -1;
+            for (int k = 0; k < count; k++)
+                if (next[k] < inputs[k].row_count && (lowest == -1 ||
+                    strcmp(inputs[k].labels[next[k]].label, inputs[lowest].labels[next[lowest]].label) < 0))
+                    lowest = k;
+            (*merged)[out] = inputs[lowest].labels[next[lowest]++];
+        }
+        free(next);
+
+        // the rows are only kept to be freed, so their order does not matter
+        rows[0] = inputs[0].rows[0];
+        for (int k = 0, out = 1; k < count; k++) {
+            for (int i = 1; i < inputs[k].row_count; i++)
+                rows[out++] = inputs[k].rows[i];
+            if (k > 0)
+                free(inputs[k].rows[0]);
+            free(inputs[k].rows);
+        }
+        spreadsheet = rows;
+        spreadsheet_row_number = spreadsheet_cap = total;
+    }
+
+    for (int k = 0; k < count; k++)
+        free(inputs[k].plan);
+    free(threads);
+    free(parsed);
+    return status;
+}
+
+/**
+    finds the graphic file a graphic record names, the way
+    print_graphic_record() prints it
+    @param field is the schema entry of the graphic
+    @param value is the label's value
+    @param tag is the value's tag
+    @param name receives a graphic name made from the value; it must hold
+           LRG + SML chars
+    @return the graphic, or NULL if the record names none
+*/
+const char *record_graphic(const Field_def *field, const char *value, Cell_tag tag, char *name) {
+
+    if ((tag.length == 0) || ((field->store == STORE_GTIN) && (cell_class(tag) == CELL_NO)))
+        return NULL;
+    if ((field->emit == EMIT_GS1) && (tag.kind & CELL_SPACE))
+        return NULL;
+    if (cell_class(tag) == CELL_YES)
+        return field->graphic;
+    if (cell_class(tag) == CELL_NO)
+        return "blank-01.tif";
+
+    char *gnp = sap_lookup(value);
+    snprintf(name, LRG + SML, "%s.tif", gnp ? gnp : value);
+    return name;
+}
+
+/**
+    checks that every .tif graphic the labels' records name is in the
+    graphics folder: those of the graphic columns, SAP lookup values
+    included, and the fixed graphics of the flags. Each missing graphic is
+    reported once, with the first record that names it.
+    @param labels is the label records
+    @param set is the graphics folder's files
+    @param root is the graphics folder
+    @return the number of missing graphics, or -1 if unsuccessful
+*/
+int validate_graphics(const Label_record *labels, const Graphics_set *set, const char *root) {
+
+    const char **missing = NULL;
+    int missing_count = 0;
+
+    for (int i = 1; i < spreadsheet_row_number; i++) {
+        const Label_record *label = &labels[i];
+
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            const Field_def *field = &label_fields[f];
+            const char *graphic = NULL;
+            char name[LRG + SML];
+
+            if (field->store == STORE_FLAG) {
+                if (field->emit == EMIT_BOOLEAN_HEADER)
+                    continue;
+                if (label->flags & FLAG_YES(field->flag))
+                    graphic = field->graphic;
+                else if ((label->flags & FLAG_NO(field->flag)) && field->emit == EMIT_BOOLEAN)
+                    graphic = "blank-01.tif";
+            } else if (field->emit == EMIT_GRAPHIC || field->emit == EMIT_GS1)
+                graphic = record_graphic(field, field_text(label, field), field_tag(label, field), name);
+
+            // "Yes", "No" and "GS1" name BarTender values, not files
+            size_t len = graphic ? strlen(graphic) : 0;
+            if (len <= 4 || strcmp(graphic + len - 4, ".tif") != 0 || graphic_exists(set, graphic))
+                continue;
+
+            bool reported = false;
+            for (int m = 0; m < missing_count && !reported; m++)
+                reported = strcasecmp(missing[m], graphic) == 0;
+            if (reported)
+                continue;
+
+            const char **temp = (const char **) realloc(missing, (missing_count + 1) * sizeof(char *));
+            char *copy = strdup(graphic);
+            if (temp == NULL || copy == NULL) {
+                free(copy);
+                free(temp ? temp : missing);
+                printf("Could not allocate memory. Exiting\n");
+                return -1;
+            }
+            missing = temp;
+            missing[missing_count++] = copy;
+            printf("Graphic \"%s\" for %s in record %d is not in \"%s\".\n", graphic, field->column, i, root);
+        }
+    }
+
+    for (int m = 0; m < missing_count; m++)
+        free((char *) missing[m]);
+    free(missing);
+    return missing_count;
+}
+
+/** a problem --check found                                              */
+typedef struct {
+    int record;
+    char label[MAX_LABEL_LEN];
+    const char *column;
+    const char *code;
+    char *value;
+} Diagnostic;
+
+/** the problems found in the column headings or by one checking thread   */
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int cap;
+} Diagnostics;
+
+/** the rows one checking thread checks                                   */
+typedef struct {
+    const Label_record *labels;
+    int first;
+    int end;
+    Diagnostics found;
+    int status;
+} Check_run;
+
+/**
+    adds a problem to a list
+    @param d is the list
+    @param record is the record number, or 0 for the column headings
+    @param label is the record's label, or "" for the column headings
+    @param column is the column the problem is in, or "" for none
+    @param code names the problem
+    @param value is the value at fault, which is copied
+    @return 0 if successful, -1 if unsuccessful
+*/
+int add_diagnostic(Diagnostics *d, int record, const char *label, const char *column,
+                   const char *code, const char *value) {
+
+    if (d->count == d->cap) {
+        int cap = d->cap ? 2 * d->cap : 64;
+        Diagnostic *items = (Diagnostic *) realloc(d->items, cap * sizeof(Diagnostic));
+        if (items == NULL)
+            return -1;
+        d->items = items;
+        d->cap = cap;
+    }
+
+    Diagnostic *item = &d->items[d->count];
+    if ((item->value = strdup(value)) == NULL)
+        return -1;
+    item->record = record;
+    strlcpy(item->label, label, sizeof(item->label));
+    item->column = column;
+    item->code = code;
+    d->count++;
+    return 0;
+}
+
+void free_diagnostics(Diagnostics *d) {
+
+    for (int i = 0; i < d->count; i++)
+        free(d->items[i].value);
+    free(d->items);
+    d->items = NULL;
+    d->count = d->cap = 0;
+}
+
+/**
+    checks the column headings of a spreadsheet: repeated headings, a
+    heading given with its alias, and missing LABEL and TEMPLATENUMBER
+    columns
+    @param headings is the column headings line
+    @param d receives the problems
+    @return 1 if the spreadsheet cannot be parsed, 0 if it can, -1 if
+    unsuccessful
+*/
+int check_headings(const char *headings, Diagnostics *d) {
+
+    const char *seen[FIELD_COUNT] = {0};
+    const char *cp = headings;
+    int rc = 0;
+
+    while (*cp && rc != -1) {
+        size_t len = strcspn(cp, "\t");
+        char heading[LRG + MED];
+        snprintf(heading, sizeof(heading), "%.*s", (int) len, cp);
+
+        const Field_def *field = find_field(heading);
+        if (field && !wanted_fields[field - label_fields])
+            field = NULL;
+
+        if (field) {
+            int f = (int) (field - label_fields);
+            if (seen[f] != NULL) {
+                bool repeated = strcmp(heading, seen[f]) == 0;
+                if (add_diagnostic(d, 0, "", field->column, repeated ? "REPEATED_COLUMN" : "ALIAS_COLUMN", heading) != 0)
+                    return -1;
+                rc = 1;
+            } else
+                seen[f] = (strcmp(heading, field->column) == 0) ? field->column : field->alias;
+        }
+
+        cp += len;
+        if (*cp == '\t')
+            cp++;
+    }
+
+    if ((seen[FIELD_label] == NULL && add_diagnostic(d, 0, "", "LABEL", "MISSING_COLUMN", "") != 0) ||
+        (seen[FIELD_template] == NULL && add_diagnostic(d, 0, "", "TEMPLATENUMBER", "MISSING_COLUMN", "") != 0))
+        return -1;
+    return rc;
+}
+
+/**
+    checks one label record the way printing it would, without printing:
+    its LBL prefix and template, its REVISION format, its GTINs and its
+    values that should be in the SAP lookup array
+    @return 0 if successful, -1 if unsuccessful
+*/
+int check_label(const Label_record *label, int record, Diagnostics *d) {
+
+    static const char *gtin_codes[] = {"GTIN_NONNUMERIC", "GTIN_LENGTH", "GTIN_CHECK_DIGIT", "GTIN_PREFIX"};
+
+    if (strncmp(label->label, "LBL", 3) != 0 &&
+        add_diagnostic(d, record, label->label, "LABEL", "LABEL_PREFIX", label->label) != 0)
+        return -1;
+    if (strlen(label->template) == 0 &&
+        add_diagnostic(d, record, label->label, "TEMPLATENUMBER", "MISSING_TEMPLATE", "") != 0)
+        return -1;
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        const Field_def *field = &label_fields[f];
+        if (!wanted_fields[f])
+            continue;
+        if (field->store == STORE_FLAG || field->store == STORE_TEXT)
+            continue;
+
+        const char *value = field_text(label, field);
+        Cell_tag tag = field_tag(label, field);
+        bool blank = (tag.length == 0) || (cell_class(tag) == CELL_NO);
+
+        // a blank revision, or one from a spreadsheet with no REVISION column, is not checked
+        if (field->emit == EMIT_REVISION && tag.length > 0 && !valid_revision(value) &&
+            add_diagnostic(d, record, label->label, field->column, "INVALID_REVISION", value) != 0)
+            return -1;
+
+        // a GTIN value is checked unless blank; a GTIN graphic unless "N", and not for being numeric
+        if (field->store == STORE_GTIN && !(field->emit == EMIT_VALUE ? blank : cell_class(tag) == CELL_NO)) {
+            int prefix = 0;
+            int problems = check_gtin(value, &prefix);
+
+            if (field->emit != EMIT_VALUE)
+                problems &= ~GTIN_NONNUMERIC;
+            for (int bit = 0; bit < 4; bit++)
+                if ((problems & (1 << bit)) &&
+                    add_diagnostic(d, record, label->label, field->column, gtin_codes[bit], value) != 0)
+                    return -1;
+        }
+
+        if (field->store == STORE_LOOKUP && (field->attrs & ATTR_STANDARD) && field->emit == EMIT_VALUE &&
+            !blank && sap_lookup(value) == NULL &&
+            add_diagnostic(d, record, label->label, field->column, "NOT_STANDARD", value) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+    checks a block of label records; run on a thread of its own
+    @param arg is the Check_run
+    @return NULL
+*/
+void *check_worker(void *arg) {
+
+    Check_run *run = (Check_run *) arg;
+
+    for (int i = run->first; i < run->end && run->status == 0; i++)
+        run->status = check_label(&run->labels[i], i, &run->found);
+    return NULL;
+}
+
+/**
+    reports repeated labels, each with one table insert: rows identical to
+    the first row of their label, and rows that differ from it, with the
+    columns that differ
+    @return 0 if successful, -1 if unsuccessful
+*/
+int check_duplicates(const Label_record *labels, Diagnostics *d) {
+
+    Label_table table;
+    int rc = 0;
+
+    if (label_table_init(&table, spreadsheet_row_number) != 0)
+        return -1;
+
+    for (int i = 1; i < spreadsheet_row_number && rc == 0; i++) {
+        bool found;
+        Label_entry *entry = label_table_insert(&table, labels[i].label, &found);
+        char value[FIELD_COUNT * (MED + 2)];
+
+        if (!found) {
+            entry->row = i;
+            continue;
+        }
+
+        // a row is identical to the first row of its label only if every field is
+        const Field_def *diffs[FIELD_COUNT];
+        int count = label_record_diff(&labels[entry->row], &labels[i], diffs);
+        int len = snprintf(value, sizeof(value), "record %d", entry->row);
+        if (count == 0)
+            rc = add_diagnostic(d, i, labels[i].label, "LABEL", "REPEATED_LABEL", value);
+        else {
+            for (int c = 0; c < count && len < (int) sizeof(value); c++)
+                len += snprintf(value + len, sizeof(value) - len, "%s%s", c > 0 ? "," : ": ", diffs[c]->column);
+            rc = add_diagnostic(d, i, labels[i].label, "LABEL", "CONFLICTING_LABEL", value);
+        }
+    }
+    label_table_free(&table);
+    return rc;
+}
+
+static int compare_diagnostics(const void *a, const void *b) {
+
+    const Diagnostic *x = (const Diagnostic *) a;
+    const Diagnostic *y = (const Diagnostic *) b;
+    int c;
+
+    if (x->record != y->record)
+        return x->record < y->record ? -1 : 1;
+    if ((c = strcmp(x->column, y->column)) != 0)
+        return c;
+    if ((c = strcmp(x->code, y->code)) != 0)
+        return c;
+    return strcmp(x->value, y->value);
+}
+
+/**
+    writes the problems found, sorted by record, column and problem, as
+    tab-delimited lines: RECORD, LABEL, COLUMN, CODE and VALUE. Record 0 is
+    the column headings.
+    @return 0 if successful, -1 if unsuccessful
+*/
+int write_check_report(const char *name, Diagnostics *d) {
+
+    FILE *fp = fopen(name, "w");
+
+    if (fp == NULL)
+        return -1;
+    qsort(d->items, (size_t) d->count, sizeof(Diagnostic), compare_diagnostics);
+    fprintf(fp, "RECORD\tLABEL\tCOLUMN\tCODE\tVALUE\n");
+    for (int i = 0; i < d->count; i++)
+        fprintf(fp, "%d\t%s\t%s\t%s\t%s\n", d->items[i].record, d->items[i].label,
+                d->items[i].column, d->items[i].code, d->items[i].value);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+    checks every label record, with the rows split among a thread per
+    processor, and every label for repeats, then writes all the problems
+    found, those of the column headings included, to one sorted report
+    @param labels is the sorted label records
+    @param d holds the column headings' problems, and receives the rest
+    @param report is the report file name
+    @return the number of problems found, or -1 if unsuccessful
+*/
+int check_labels(const Label_record *labels, Diagnostics *d, const char *report) {
+
+    int rows = spreadsheet_row_number - 1;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int run_count = (int) (workers < 1 ? 1 : (workers > rows ? (rows > 0 ? rows : 1) : workers));
+    Check_run *runs = (Check_run *) calloc(run_count, sizeof(Check_run));
+    pthread_t *threads = (pthread_t *) malloc(run_count * sizeof(pthread_t));
+    int status = 0;
+
+    if (runs == NULL || threads == NULL) {
+        free(runs);
+        free(threads);
+        return -1;
+    }
+
+    for (int r = 0; r < run_count; r++) {
+        runs[r].labels = labels;
+        runs[r].first = 1 + (int) ((long) rows * r / run_count);
+        runs[r].end = 1 + (int) ((long) rows * (r + 1) / run_count);
+    }
+
+    // a run whose thread cannot start is checked on this one
+    for (int r = 0; r < run_count; r++)
+        if (pthread_create(&threads[r], NULL, check_worker, &runs[r]) != 0) {
+            check_worker(&runs[r]);
+            threads[r] = pthread_self();
+        }
+    for (int r = 0; r < run_count; r++) {
+        if (!pthread_equal(threads[r], pthread_self()))
+            pthread_join(threads[r], NULL);
+        for (int i = 0; i < runs[r].found.count && status == 0; i++) {
+            Diagnostic *item = &runs[r].found.items[i];
+            status = add_diagnostic(d, item->record, item->label, item->column, item->code, item->value);
+        }
+        if (runs[r].status != 0)
+            status = -1;
+        free_diagnostics(&runs[r].found);
+    }
+    free(runs);
+    free(threads);
+
+    if (status != 0 || check_duplicates(labels, d) != 0 || write_check_report(report, d) != 0)
+        return -1;
+    return d->count;
+}
+
+/**
+    frees the spreadsheet rows and the label records; labels mapped from a
+    snapshot are unmapped with it
+    @param labels is the label records
+    @param snapshot is the snapshot the labels were mapped from, if any
+*/
+void free_labels(Label_record *labels, Label_snapshot *snapshot) {
+
+    for (int i = 0; i < spreadsheet_row_number; i++)
+        free(spreadsheet[i]);
+    free(spreadsheet);
+
+    if (snapshot->base != NULL)
+        close_label_snapshot(snapshot);
+    else {
+        for (int i = 1; i < spreadsheet_row_number; i++) {
+            free(labels[i].tdline);
+            free(labels[i].tdline_segments);
+        }
+        free(labels);
+    }
+}
+
+int main(int argc, char *argv[]) {
 
-    typedef struct control_numbers Ctrl;
+    // elapsed time
+    clock_t start = clock();
 
-    Ctrl idoc = {"2541435", 0, 1, 0, 0};
+    // the Label_record array
+    Label_record *labels = NULL;
+
+    // the IDocs to write; without -V there is one, set by -n and -J
+    Variant variants[MAX_VARIANTS] = {0};
+    int variant_count = 1;
+    bool variant_list = false;
+
+    // the caps that split each IDoc into several files
+    int max_labels = 0;
+    size_t max_bytes = 0;
+    bool by_material = false;
+
+    // whether to write each IDoc into a preallocated file from parallel runs
+    bool preallocate = false;
+
+    // the file that numbers the IDocs, or NULL to give them all the default number
+    const char *counter_file = NULL;
+
+    // whether to write a sidecar index of each IDoc
+    bool index_output = false;
+
+    // the label rows to convert; without filters, all of them
+    Row_filter filter = {0};
+
+    // the spreadsheets to merge into one IDoc; the first one names it
+    Input *inputs = NULL;
+    int input_count = 1;
+    int rows_read = 0;
+
+    // the graphics folder to check the graphics against, and its snapshot
+    const char *graphics_root = NULL;
+    const char *graphics_snapshot = NULL;
+
+    // the snapshot of the parsed labels to load instead of parsing, and to save
+    const char *snapshot_in = NULL;
+    const char *snapshot_out = NULL;
+    Label_snapshot snapshot = {NULL, 0};
+
+    // whether to only check the labels, reporting every problem instead of writing an IDoc
+    bool check_only = false;
+    Diagnostics diagnostics = {NULL, 0, 0};
+
+    // "idoc --extract IDoc.txt LBL..." prints single labels from an indexed IDoc
+    if (argc >= 2 && strcmp(argv[1], "--extract") == 0)
+        return extract_labels(argc - 2, argv + 2);
+
+    // "idoc --delta old.txt new.txt" converts only the labels new.txt adds or changes
+    const char *delta_base = NULL;
+    Delta_base delta = {0};
+    int input = 1;
+    if (argc >= 2 && strcmp(argv[1], "--delta") == 0) {
+        if (argc < 4) {
+            printf("usage: %s --delta old.txt new.txt [options]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        delta_base = argv[2];
+        input = 3;
+    }
 
     if (!check_lookup_array())
         return EXIT_FAILURE;
@@ -967,97 +2880,524 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    FILE *fp, *fpout;
-
-    if ((argc != 2) && (argc != 3)) {
-        printf("usage: %s filename.txt [-J] [-F] [-n]\n", argv[0]);
+    if (argc < 2) {
+        printf("usage: %s filename.txt [more.txt ...] [-J] [-F] [-n] [-z] [-V std,n,J,nJ] [-L labels] [-B size] [-M] [-P] [-C counterfile] [--resume] [-I]\n"
+               "       [--labels LBL,...] [--label-range FIRST LAST] [--material MATERIAL,...]\n"
+               "       [--graphics-root DIR [--graphics-snapshot FILE]] [--save-snapshot FILE] [--load-snapshot FILE]\n"
+               "       [--gtin-prefixes PREFIX,...] [--check]\n", argv[0]);
+        printf("       %s --delta old.txt new.txt [options]\n", argv[0]);
+        printf("       %s --extract IDoc.txt LBL...\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    // check for optional command line parameter '-J'
-    if (argc > 2) {
-        if (((argv[2] != NULL) && (strncmpci(argv[2], "-J", 2) == 0)) ||
-            ((argv[3] != NULL) && (strncmpci(argv[3], "-J", 2) == 0))) {
-            alt_path = true;
-        }
+    if ((inputs = (Input *) calloc(argc, sizeof(Input))) == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        return EXIT_FAILURE;
     }
+    inputs[0].filename = argv[input];
 
-    // check for optional command line parameter '-n'
-    // -n prints "non-standard" column names in the IDoc:
-    // GTIN, IPN, OLDLABEL, OLDTEMPLATE, DESCRIPTION, PREVLABEL and PREVTEMPLATE
-    if (argc > 2) {
-        if (((argv[2] != NULL) && (strncmpci(argv[2], "-n", 2) == 0)) ||
-            ((argv[3] != NULL) && (strncmpci(argv[3], "-n", 2) == 0))) {
-            non_SAP_fields = true;
+    for (int arg = input + 1; arg < argc; arg++) {
+
+        // check for optional command line parameter '-J'
+        if (strncmpci(argv[arg], "-J", 2) == 0) {
+            variants[0].alt_path = true;
+
+        // check for optional command line parameter '-n'
+        // -n prints "non-standard" column names in the IDoc:
+        // GTIN, IPN, OLDLABEL, OLDTEMPLATE, DESCRIPTION, PREVLABEL and PREVTEMPLATE
+        } else if (strncmpci(argv[arg], "-n", 2) == 0) {
+            variants[0].non_SAP_fields = true;
             printf("Including non-SAP column headings in IDoc. Run program without '-n' flag to remove.\n");
+
+        // check for optional command line parameter '-z'
+        // -z gzip-compresses the IDoc on a separate thread as it is written
+        } else if (strncmpci(argv[arg], "-z", 2) == 0) {
+            compress_output = true;
+
+        // check for optional command line parameter '-V'
+        // -V writes several IDoc variants from one parse, e.g. -V std,n,J
+        } else if (strncmpci(argv[arg], "-V", 2) == 0) {
+            if (arg + 1 >= argc) {
+                printf("-V needs a list of IDoc variants, e.g. -V std,n,J\n");
+                return EXIT_FAILURE;
+            }
+            if ((variant_count = parse_variants(argv[++arg], variants)) <= 0)
+                return EXIT_FAILURE;
+            variant_list = true;
+
+        // check for optional command line parameters '-L', '-B' and '-M'
+        // -L and -B cap each IDoc file's labels and bytes, e.g. -L 500 or -B 50M;
+        // -M writes each material's labels to a file of their own
+        } else if (strncmpci(argv[arg], "-L", 2) == 0) {
+            if (arg + 1 >= argc || (max_labels = atoi(argv[++arg])) <= 0) {
+                printf("-L needs the most labels to write to one IDoc file, e.g. -L 500\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmpci(argv[arg], "-B", 2) == 0) {
+            if (arg + 1 >= argc || parse_size(argv[++arg], &max_bytes) != 0) {
+                printf("-B needs the most bytes to write to one IDoc file, e.g. -B 50M\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmpci(argv[arg], "-M", 2) == 0) {
+            by_material = true;
+
+        // check for optional command line parameter '-P'
+        // -P computes each IDoc's exact size, preallocates its file and writes
+        // runs of labels into it in parallel, each at its own offset
+        } else if (strncmpci(argv[arg], "-P", 2) == 0) {
+            preallocate = true;
+
+        // check for optional command line parameter '-C'
+        // -C numbers each IDoc file from a counter file shared by parallel runs
+        } else if (strncmpci(argv[arg], "-C", 2) == 0) {
+            if (arg + 1 >= argc) {
+                printf("-C needs a control number counter file, e.g. -C idoc.counter\n");
+                return EXIT_FAILURE;
+            }
+            counter_file = argv[++arg];
+
+        // check for optional command line parameter '--resume'
+        // --resume continues each IDoc from the checkpoint an earlier run left
+        } else if (strcmp(argv[arg], "--resume") == 0) {
+            resume_output = true;
+
+        // check for optional command line parameter '-I'
+        // -I writes a sidecar index of where each label is in its IDoc, which
+        // "idoc --extract IDoc.txt LBL..." uses to print single labels
+        } else if (strncmpci(argv[arg], "-I", 2) == 0) {
+            index_output = true;
+
+        // check for optional command line parameters '--labels', '--label-range' and '--material'
+        // they convert only the given labels, a range of labels or the labels of given materials
+        } else if (strcmp(argv[arg], "--labels") == 0 || strcmp(argv[arg], "--material") == 0) {
+            bool labels_list = strcmp(argv[arg], "--labels") == 0;
+            if (arg + 1 >= argc) {
+                printf("%s needs a comma-separated list, e.g. %s\n", argv[arg],
+                       labels_list ? "--labels LBL0001,LBL0002" : "--material 10001,10002");
+                return EXIT_FAILURE;
+            }
+            if ((labels_list ? add_filter_values(argv[++arg], &filter.labels, &filter.label_count) :
+                 add_filter_values(argv[++arg], &filter.materials, &filter.material_count)) != 0) {
+                printf("Could not allocate memory. Exiting\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[arg], "--label-range") == 0) {
+            if (arg + 2 >= argc) {
+                printf("--label-range needs the first and last label, e.g. --label-range LBL0001 LBL0099\n");
+                return EXIT_FAILURE;
+            }
+            filter.first_label = argv[++arg];
+            filter.last_label = argv[++arg];
+
+        // check for optional command line parameters '--graphics-root' and '--graphics-snapshot'
+        // they check every graphic named against the graphics folder, whose
+        // scan can be kept in a snapshot file between runs
+        } else if (strcmp(argv[arg], "--graphics-root") == 0 || strcmp(argv[arg], "--graphics-snapshot") == 0) {
+            bool root = strcmp(argv[arg], "--graphics-root") == 0;
+            if (arg + 1 >= argc) {
+                printf("%s needs a %s, e.g. %s\n", argv[arg], root ? "folder" : "file",
+                       root ? "--graphics-root /mnt/graphics" : "--graphics-snapshot graphics.snap");
+                return EXIT_FAILURE;
+            }
+            if (root)
+                graphics_root = argv[++arg];
+            else
+                graphics_snapshot = argv[++arg];
+
+        // check for optional command line parameters '--save-snapshot' and '--load-snapshot'
+        // they save the sorted labels to a binary snapshot, and map them from it
+        // in later runs for as long as the spreadsheet is unchanged
+        } else if (strcmp(argv[arg], "--save-snapshot") == 0 || strcmp(argv[arg], "--load-snapshot") == 0) {
+            if (arg + 1 >= argc) {
+                printf("%s needs a snapshot file, e.g. %s labels.snap\n", argv[arg], argv[arg]);
+                return EXIT_FAILURE;
+            }
+            if (strcmp(argv[arg], "--save-snapshot") == 0)
+                snapshot_out = argv[++arg];
+            else
+                snapshot_in = argv[++arg];
+
+        // check for optional command line parameter '--gtin-prefixes'
+        // --gtin-prefixes replaces the company prefixes a GTIN may carry
+        } else if (strcmp(argv[arg], "--gtin-prefixes") == 0) {
+            free_gtin_prefixes(&gtin_prefixes);
+            if (arg + 1 >= argc || parse_gtin_prefixes(argv[++arg], &gtin_prefixes) != 0) {
+                printf("--gtin-prefixes needs a comma-separated list of 1- to 7-digit company prefixes, e.g. --gtin-prefixes %s\n",
+                       DEFAULT_GTIN_PREFIXES);
+                return EXIT_FAILURE;
+            }
+
+        // check for optional command line parameter '--check'
+        // --check runs every validation over all rows and writes one sorted
+        // report of the problems found, instead of an IDoc
+        } else if (strcmp(argv[arg], "--check") == 0) {
+            check_only = true;
+
+        // any other argument that is not an option is another spreadsheet to merge
+        } else if (argv[arg][0] != '-') {
+            inputs[input_count++].filename = argv[arg];
         }
     }
 
-    if ((fp = fopen(argv[1], "r")) == NULL) {
-        printf("File not found.\n");
+    if (gtin_prefixes.prefixes == NULL && parse_gtin_prefixes(DEFAULT_GTIN_PREFIXES, &gtin_prefixes) != 0) {
+        printf("Could not allocate memory. Exiting\n");
         return EXIT_FAILURE;
-    } else {
-        read_spreadsheet(fp);
     }
-    fclose(fp);
-
-    labels = (Label_record *) calloc(spreadsheet_row_number, spreadsheet_row_number * sizeof(Label_record));
 
-    // check spreadsheet columns for duplicates
-    if (duplicate_column_names(spreadsheet[0])) {
-        printf("Duplicate column names in spreadsheet. Aborting.\n");
-        return EXIT_FAILURE;
+    // a snapshot holds all of one spreadsheet's labels
+    if ((snapshot_in != NULL || snapshot_out != NULL) &&
+        (delta_base != NULL || row_filter_active(&filter) || input_count > 1)) {
+        printf("--save-snapshot and --load-snapshot are ignored with --delta, filters or several spreadsheets\n");
+        snapshot_in = snapshot_out = NULL;
     }
 
-    // move data into label_record fields by column header
-    if (parse_spreadsheet(spreadsheet[0], labels) == -1) {
-        printf("Aborting.\n");
-        return EXIT_FAILURE;
+    // the spreadsheet is parsed once, with the non-SAP columns if any variant prints them
+    int report = 0;
+    for (int v = 0; v < variant_count; v++) {
+        if (variants[v].non_SAP_fields) {
+            if (!non_SAP_fields)
+                report = v;
+            non_SAP_fields = true;
+        }
     }
 
-    // the labels array must be sorted by label number
-    sort_labels(labels);
+    // the variant with the most fields is the one that reports content problems
+    variants[report].report = true;
 
-    char *outputfile = (char *) malloc(strlen(argv[1]) + FILE_EXT_LEN);
-    sscanf(argv[1], "%[^.]%*[txt]", outputfile);
+    init_flag_names();
+    for (int v = 0; v < variant_count; v++)
+        init_variant(&variants[v]);
 
-    strcat(outputfile, "_IDoc (stoidoc).txt");
-    printf("Creating IDoc file \"%s\"\n", outputfile);
+    // a current snapshot of the spreadsheet's sorted labels replaces reading, parsing and sorting it
+    if (snapshot_in != NULL) {
+        int count;
 
-    if ((fpout = fopen(outputfile, "w")) == NULL) {
-        printf("Could not open output file %s", outputfile);
+        if ((labels = load_label_snapshot(snapshot_in, argv[input], &snapshot, &count)) != NULL) {
+            // the rows are never read, so the spreadsheet array only holds their count
+            free(spreadsheet);
+            if ((spreadsheet = (char **) calloc(count, sizeof(char *))) == NULL) {
+                printf("Could not allocate memory. Exiting\n");
+                return EXIT_FAILURE;
+            }
+            spreadsheet_row_number = spreadsheet_cap = count;
+            printf("Loaded %d labels from snapshot \"%s\"\n", count - 1, snapshot_in);
+        } else
+            printf("Snapshot \"%s\" is missing or out of date; reading \"%s\"\n", snapshot_in, argv[input]);
     }
 
-    if (print_control_record(fpout, &idoc) != 0)
-        return EXIT_FAILURE;
+    if (labels == NULL) {
+        // the base of a delta is read first, leaving its label records and table
+        if (delta_base != NULL && load_delta_base(delta_base, &filter, &delta) != 0)
+            return EXIT_FAILURE;
+
+        // each input is read into a spreadsheet array of its own
+        for (int k = 0; k < input_count; k++) {
+            if (k > 0) {
+                spreadsheet_row_number = 0;
+                if (spreadsheet_init() != 0) {
+                    printf("Could not allocate memory. Exiting\n");
+                    return EXIT_FAILURE;
+                }
+            }
+            if (read_input(inputs[k].filename, &filter) != 0)
+                return EXIT_FAILURE;
+            if (input_count > 1 && spreadsheet_row_number == 0) {
+                printf("\"%s\" is empty. Aborting.\n", inputs[k].filename);
+                return EXIT_FAILURE;
+            }
+            inputs[k].rows = spreadsheet;
+            inputs[k].row_count = spreadsheet_row_number;
+            rows_read += spreadsheet_row_number - 1;
+        }
 
-    {
-        int i = 1;
-        while (i < spreadsheet_row_number) {
-            if ((print_label_idoc_records(fpout, labels, i, &idoc)))
-                i++;
-            else {
-                printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", i);
+        if (row_filter_active(&filter)) {
+            free_row_filter(&filter);
+            if (rows_read < 1) {
+                printf("No label rows match the --labels, --label-range or --material filters. Aborting.\n");
+                return EXIT_FAILURE;
+            }
+            printf("Converting the %d label rows that match the filters\n", rows_read);
+        }
+
+        // --check reports column headings it cannot parse instead of stopping at the first
+        for (int k = 0; k < input_count && check_only; k++) {
+            int rc = check_headings(inputs[k].rows[0], &diagnostics);
+            if (rc != 0) {
+                char *check_report = (char *) malloc(strlen(argv[input]) + FILE_EXT_LEN);
+                if (check_report == NULL) {
+                    printf("Could not allocate memory. Exiting\n");
+                    return EXIT_FAILURE;
+                }
+                sscanf(argv[input], "%[^.]%*[txt]", check_report);
+                strcat(check_report, "_check.txt");
+                if (rc == 1 && write_check_report(check_report, &diagnostics) == 0)
+                    printf("The column headings of \"%s\" cannot be parsed. Creating check report \"%s\"\n",
+                           inputs[k].filename, check_report);
+                else
+                    printf("Could not write check report %s\n", check_report);
+                free(check_report);
+                return EXIT_FAILURE;
+            }
+        }
+
+        // several inputs are parsed concurrently and merged in label order
+        if (input_count > 1) {
+            if (merge_inputs(inputs, input_count, &labels) != 0)
+                return EXIT_FAILURE;
+        } else {
+            labels = (Label_record *) calloc(spreadsheet_row_number, sizeof(Label_record));
+            if (labels == NULL) {
+                printf("Could not allocate memory. Exiting\n");
+                return EXIT_FAILURE;
+            }
+
+            // check spreadsheet columns for duplicates
+            if (duplicate_column_names(spreadsheet[0])) {
+                printf("Duplicate column names in spreadsheet. Aborting.\n");
+                return EXIT_FAILURE;
+            }
+
+            // move data into label_record fields by column header
+            if (parse_spreadsheet(spreadsheet[0], labels) == -1) {
+                printf("Aborting.\n");
+                return EXIT_FAILURE;
+            }
+        }
+
+        // a delta keeps only the new and changed labels
+        if (delta_base != NULL) {
+            char *deleted_report = (char *) malloc(strlen(argv[input]) + FILE_EXT_LEN);
+            if (deleted_report == NULL) {
+                printf("Could not allocate memory. Exiting\n");
+                return EXIT_FAILURE;
+            }
+            sscanf(argv[input], "%[^.]%*[txt]", deleted_report);
+            strcat(deleted_report, "_deleted.txt");
+
+            int rc = apply_delta(labels, &delta, deleted_report);
+            free_delta_base(&delta);
+            free(deleted_report);
+            if (rc != 0)
                 return EXIT_FAILURE;
+            if (spreadsheet_row_number < 2) {
+                printf("No labels were added or changed since \"%s\"; no IDoc written.\n", delta_base);
+                return EXIT_SUCCESS;
             }
         }
+
+        // a label repeated with identical contents is converted once; --check reports it
+        if (!check_only && collapse_duplicates(labels) == -1)
+            return EXIT_FAILURE;
+
+        // the labels array must be sorted by label number; merged inputs already are
+        if (input_count == 1)
+            sort_labels(labels);
+
+        if (snapshot_out != NULL) {
+            if (save_label_snapshot(snapshot_out, argv[input], labels, spreadsheet_row_number) == 0)
+                printf("Creating snapshot \"%s\"\n", snapshot_out);
+            else
+                printf("Could not write snapshot \"%s\"\n", snapshot_out);
+        }
+    }
+
+    // every distinct GTIN is checked once, before the checks and writers look them up
+    if (check_all_gtins(&gtin_cache, &gtin_prefixes, labels, spreadsheet_row_number) != 0) {
+        printf("Could not allocate memory. Exiting\n");
+        return EXIT_FAILURE;
+    }
+
+    // every graphic named is looked up in one scan of the graphics folder
+    if (graphics_root != NULL) {
+        Graphics_set graphics;
+        int missing;
+
+        if (load_graphics(&graphics, graphics_root, graphics_snapshot) != 0) {
+            printf("Could not read the graphics folder \"%s\". Aborting.\n", graphics_root);
+            return EXIT_FAILURE;
+        }
+        missing = validate_graphics(labels, &graphics, graphics_root);
+        free_graphics(&graphics);
+        if (missing == -1)
+            return EXIT_FAILURE;
+        if (missing > 0)
+            printf("%d graphics are missing from \"%s\".\n", missing, graphics_root);
+    } else if (graphics_snapshot != NULL)
+        printf("--graphics-snapshot is ignored without --graphics-root\n");
+
+    // --check writes its report instead of an IDoc
+    if (check_only) {
+        char *check_report = (char *) malloc(strlen(argv[input]) + FILE_EXT_LEN);
+        if (check_report == NULL) {
+            printf("Could not allocate memory. Exiting\n");
+            return EXIT_FAILURE;
+        }
+        sscanf(argv[input], "%[^.]%*[txt]", check_report);
+        strcat(check_report, "_check.txt");
+
+        int problems = check_labels(labels, &diagnostics, check_report);
+        free_diagnostics(&diagnostics);
+        if (problems == -1) {
+            printf("Could not write check report %s\n", check_report);
+            free(check_report);
+            return EXIT_FAILURE;
+        }
+        printf("Checked %d label rows: %d problems found. Creating check report \"%s\"\n",
+               spreadsheet_row_number - 1, problems, check_report);
+        free(check_report);
+        free_labels(labels, &snapshot);
+        free_gtin_cache(&gtin_cache);
+        free_gtin_prefixes(&gtin_prefixes);
+        free(inputs);
+        return problems == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    fclose(fpout);
-    free(outputfile);
+    // each distinct graphic record is rendered once, and copied for every label that prints it
+    if (cache_graphic_records(labels, variants, variant_count) != 0) {
+        printf("Could not allocate memory. Exiting\n");
+        return EXIT_FAILURE;
+    }
 
-    for (int i = 0; i < spreadsheet_row_number; i++)
-        free(spreadsheet[i]);
-    free(spreadsheet);
+    // each variant is split into shards, or written as one IDoc file without -L, -B or -M
+    Shard *shards = NULL;
+    int shard_count = 0;
+    bool sharded = (max_labels > 0) || (max_bytes > 0) || by_material;
+
+    for (int v = 0; v < variant_count; v++) {
+        int first = shard_count;
+
+        variants[v].labels = labels;
+        if (plan_shards(&variants[v], max_labels, max_bytes, by_material, &shards, &shard_count) != 0)
+            return EXIT_FAILURE;
+
+        // past six digits of sequence numbers, an IDoc is split even without -L, -B or -M
+        bool numbered = sharded || (shard_count - first > 1);
+        if (!sharded && numbered)
+            printf("The IDoc needs more than %d records, so it is split into %d files.\n",
+                   MAX_SEQUENCE_NUMBER, shard_count - first);
+
+        for (int s = first; s < shard_count; s++) {
+            char *outputfile = (char *) malloc(strlen(argv[input]) + FILE_EXT_LEN + SHARD_EXT_LEN);
+            sscanf(argv[input], "%[^.]%*[txt]", outputfile);
+
+            // with -V, each variant's options are part of its file name
+            strcat(outputfile, "_IDoc (stoidoc");
+            if (variant_list && variants[v].non_SAP_fields)
+                strcat(outputfile, " -n");
+            if (variant_list && variants[v].alt_path)
+                strcat(outputfile, " -J");
+            if (delta_base != NULL)
+                strcat(outputfile, " --delta");
+            strcat(outputfile, ")");
+
+            // shards are numbered from 1
+            if (numbered)
+                sprintf(outputfile + strlen(outputfile), "_%03d", s - first + 1);
+            strcat(outputfile, ".txt");
+            if (compress_output)
+                strcat(outputfile, GZ_EXT);
+            printf("Creating IDoc file \"%s\"\n", outputfile);
+
+            shards[s].outputfile = outputfile;
+        }
+    }
 
-    for (int i = 1; i < spreadsheet_row_number; i++)
-        free(labels[i].tdline);
+    // a compressed IDoc's size is not known in advance, so it is always streamed
+    if (preallocate && compress_output) {
+        printf("-P is ignored with -z.\n");
+        preallocate = false;
+    }
 
-    free(labels);
+    // only an uncompressed IDoc written in order has checkpoints
+    if (resume_output && (preallocate || compress_output)) {
+        printf("--resume is ignored with %s.\n", preallocate ? "-P" : "-z");
+        resume_output = false;
+    }
+
+    // a resumed IDoc keeps its control number; one reservation numbers the others
+    int new_ctrl_nums = 0;
+    for (int s = 0; s < shard_count; s++)
+        if (!(counter_file != NULL && resume_output && resume_ctrl_num(&shards[s]) == 0))
+            new_ctrl_nums++;
+
+    long first_ctrl_num = atol(DEFAULT_CONTROL_NUMBER);
+    if (counter_file != NULL && new_ctrl_nums > 0 &&
+        reserve_control_numbers(counter_file, new_ctrl_nums, &first_ctrl_num) != 0) {
+        printf("Could not reserve control numbers from \"%s\". Aborting.\n", counter_file);
+        return EXIT_FAILURE;
+    }
+    for (int s = 0, n = 0; s < shard_count; s++)
+        if (shards[s].ctrl_num[0] == '\0')
+            format_control_number(shards[s].ctrl_num, first_ctrl_num, counter_file != NULL ? n++ : 0);
+
+    // the workers fill in each label's index entry as they write it
+    for (int s = 0; s < shard_count && index_output; s++) {
+        size_t entries = (size_t) (shards[s].last - shards[s].first);
+        if ((shards[s].index = (Index_entry *) calloc(entries > 0 ? entries : 1, sizeof(Index_entry))) == NULL) {
+            printf("Could not allocate memory. Exiting\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    Run *runs = NULL;
+    int run_count = 0;
+    for (int s = 0; s < shard_count; s++)
+        if (plan_runs(&shards[s], preallocate, &runs, &run_count) != 0) {
+            status = EXIT_FAILURE;
+            free(shards[s].index);
+            shards[s].index = NULL;
+        }
+
+    // the runs only read the shared label records, so a pool of workers writes them in parallel
+    Run_queue queue = {runs, run_count, 0, PTHREAD_MUTEX_INITIALIZER};
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > run_count)
+        workers = run_count;
+
+    pthread_t *threads = (pthread_t *) calloc(workers > 1 ? (size_t) workers : 1, sizeof(pthread_t));
+    int thread_count = 0;
+    for (long w = 1; w < workers && threads != NULL; w++)
+        if (pthread_create(&threads[thread_count], NULL, run_worker, &queue) == 0)
+            thread_count++;
+    run_worker(&queue);
+
+    for (int t = 0; t < thread_count; t++)
+        pthread_join(threads[t], NULL);
+    free(threads);
+
+    // an IDoc that was not written completely gets no index
+    for (int r = 0; r < run_count; r++) {
+        if (runs[r].status != 0) {
+            status = EXIT_FAILURE;
+            free(runs[r].shard->index);
+            runs[r].shard->index = NULL;
+        }
+    }
+    free(runs);
+
+    for (int s = 0; s < shard_count; s++) {
+        if (shards[s].fd >= 0 && close(shards[s].fd) != 0) {
+            printf("Could not write output file %s\n", shards[s].outputfile);
+            status = EXIT_FAILURE;
+        } else if (shards[s].index != NULL && write_index(&shards[s]) != 0)
+            status = EXIT_FAILURE;
+        free(shards[s].index);
+        free(shards[s].outputfile);
+    }
+    free(shards);
+    if (status != EXIT_SUCCESS)
+        return status;
+
+    free_labels(labels, &snapshot);
+    free_gtin_cache(&gtin_cache);
+    free_gtin_prefixes(&gtin_prefixes);
+    record_cache_free(&graphic_records);
+    free(inputs);
 
     clock_t stop = clock();
     double elapsed = (double) (stop - start) / CLOCKS_PER_SEC;
     printf("\nTime elapsed in stoidoc: %.5f\n", elapsed);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,325 @@
+/**
+ *  idoc2txt.c turns an IDoc written by idoc back into the tab-delimited
+ *  spreadsheet idoc reads. The IDoc is decoded in a single streaming pass;
+ *  each label's records are collected into one spreadsheet row, which is
+ *  written as soon as the next label starts. The columns are those of the
+ *  LABEL_FIELDS schema, in schema order.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "label.h"
+#include "stream.h"
+
+/* offsets of the fixed-width IDoc record fields                          */
+#define SEGMENT_LEN          11
+#define DATA_OFFSET          63
+#define KEY_LEN              18
+#define CHAR_NAME_OFFSET     63
+#define CHAR_VALUE_OFFSET    93
+
+/* the TDLINE text follows this tag, the label and TDLINE_INDENT spaces    */
+#define TDLINE_TAG           "GRUNE  ENMATERIAL  "
+
+/** the parts of a schema entry the decoder needs                          */
+typedef struct {
+    const char *column;
+    Store_kind store;
+    Emit_kind emit;
+    const char *graphic;
+    unsigned int attrs;
+} Column;
+
+#define COLUMN(member, column, alias, store, emit, size, graphic, attrs) \
+    {column, store, emit, graphic, attrs},
+
+static const Column columns[FIELD_COUNT] = {
+    LABEL_FIELDS(COLUMN)
+};
+
+/** reverse index entry: a GRAPHIC0x graphic and the flag column it encodes */
+typedef struct {
+    const char *graphic;
+    int field;
+} Graphic_entry;
+
+static Graphic_entry graphic_index[FIELD_COUNT];
+static int graphic_index_len;
+
+/* the cells of the row being collected, one per schema column            */
+static char *cells[FIELD_COUNT];
+
+static int compare_graphics(const void *a, const void *b) {
+    return strcmp(((const Graphic_entry *) a)->graphic, ((const Graphic_entry *) b)->graphic);
+}
+
+/**
+    builds the reverse index from a GRAPHIC0x graphic file to its column
+*/
+static void build_graphic_index() {
+
+    for (int f = 0; f < FIELD_COUNT; f++)
+        if (columns[f].emit == EMIT_GRAPHIC0X)
+            graphic_index[graphic_index_len++] = (Graphic_entry) {columns[f].graphic, f};
+    qsort(graphic_index, (size_t) graphic_index_len, sizeof(Graphic_entry), compare_graphics);
+}
+
+/**
+    finds the column of a characteristic record by its name
+    @return the column's field number, or -1 if it is not in the schema
+*/
+static int find_column(const char *name) {
+
+    for (int f = 0; f < FIELD_COUNT; f++)
+        if (strcmp(columns[f].column, name) == 0)
+            return f;
+    return -1;
+}
+
+/**
+    returns the length of a string of n characters without its trailing spaces
+*/
+static size_t trimmed_len(const char *s, size_t n) {
+
+    while (n > 0 && s[n - 1] == ' ')
+        n--;
+    return n;
+}
+
+/**
+    stores a copy of n characters of text as a cell of the current row,
+    replacing any previous value
+*/
+static void set_cell(int field, const char *text, size_t n) {
+
+    free(cells[field]);
+    if ((cells[field] = (char *) malloc(n + 1)) == NULL) {
+        fprintf(stderr, "Could not allocate memory. Exiting\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(cells[field], text, n);
+    cells[field][n] = '\0';
+}
+
+/**
+    appends n characters of text to a cell of the current row
+*/
+static void append_cell(int field, const char *text, size_t n) {
+
+    size_t len = cells[field] ? strlen(cells[field]) : 0;
+    char *cell = (char *) realloc(cells[field], len + n + 1);
+
+    if (cell == NULL) {
+        fprintf(stderr, "Could not allocate memory. Exiting\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(cell + len, text, n);
+    cell[len + n] = '\0';
+    cells[field] = cell;
+}
+
+/**
+    returns the position of the graphics folder path in the tail of a
+    characteristic record, or NULL if the tail holds no graphic path
+*/
+static const char *find_graphic_path(const char *tail) {
+
+    const char *path = strstr(tail, GRAPHICS_PATH);
+    return path ? path : strstr(tail, ALT_GRAPHICS_PATH);
+}
+
+/**
+    decodes a Z2BTLC characteristic record into its cell of the current row.
+    The value column holds the cell as it was in the spreadsheet, before any
+    SAP lookup, so only GRAPHIC0x records need their graphic mapped back.
+    @return 0 if successful, -1 if the characteristic is unknown
+*/
+static int decode_characteristic(const char *line, size_t len) {
+
+    char name[CHAR_COL_LEN + 1];
+    size_t n;
+
+    if (len <= CHAR_VALUE_OFFSET)
+        return -1;
+    n = trimmed_len(line + CHAR_NAME_OFFSET, CHAR_COL_LEN);
+    memcpy(name, line + CHAR_NAME_OFFSET, n);
+    name[n] = '\0';
+
+    const char *tail = line + CHAR_VALUE_OFFSET;
+    size_t tail_len = trimmed_len(tail, len - CHAR_VALUE_OFFSET);
+
+    // GRAPHIC01 - GRAPHIC14 are numbered as printed; the graphic names the flag
+    if (strncmp(name, "GRAPHIC", 7) == 0 && find_column(name) < 0) {
+        const char *path = find_graphic_path(tail);
+        if (path == NULL)
+            return -1;
+        path += strncmp(path, GRAPHICS_PATH, strlen(GRAPHICS_PATH)) == 0 ?
+                strlen(GRAPHICS_PATH) : strlen(ALT_GRAPHICS_PATH);
+
+        char graphic[GRAPHIC_PATH_LEN + 1];
+        snprintf(graphic, sizeof(graphic), "%.*s", (int) trimmed_len(path, strlen(path)), path);
+
+        Graphic_entry key = {graphic, 0};
+        Graphic_entry *hit = bsearch(&key, graphic_index, (size_t) graphic_index_len,
+                                     sizeof(Graphic_entry), compare_graphics);
+        if (hit == NULL)
+            return -1;
+        set_cell(hit->field, "Y", 1);
+        return 0;
+    }
+
+    int field = find_column(name);
+    if (field < 0)
+        return -1;
+
+    switch (columns[field].emit) {
+        case EMIT_INFO:
+        case EMIT_REVISION:
+        case EMIT_VALUE:
+            if (columns[field].store == STORE_LOOKUP) {
+                // the value is followed by its SAP lookup value, or by itself
+                set_cell(field, tail, trimmed_len(tail, tail_len < CHAR_COL_LEN ? tail_len : CHAR_COL_LEN));
+            } else {
+                // the value is printed twice; a long one pushes its copy right
+                n = trimmed_len(tail, tail_len < CHAR_COL_LEN ? tail_len : CHAR_COL_LEN);
+                set_cell(field, tail, n < CHAR_COL_LEN ? n : tail_len / 2);
+            }
+            break;
+
+        default: {
+            // a graphic value ends where the graphic path starts
+            const char *path = find_graphic_path(tail);
+            n = path ? (size_t) (path - tail) : (tail_len < CHAR_COL_LEN ? tail_len : CHAR_COL_LEN);
+            set_cell(field, tail, trimmed_len(tail, n));
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+    writes a cell, quoting it if it contains quotes and its column's cells
+    are decoded at ingest
+*/
+static void write_cell(FILE *fpout, int field) {
+
+    const char *cell = cells[field] ? cells[field] : "";
+
+    if ((columns[field].attrs & ATTR_QUOTED) && strchr(cell, '\"')) {
+        fputc('\"', fpout);
+        for (const char *cp = cell; *cp; cp++) {
+            if (*cp == '\"')
+                fputc('\"', fpout);
+            fputc(*cp, fpout);
+        }
+        fputc('\"', fpout);
+    } else
+        fputs(cell, fpout);
+}
+
+/**
+    writes the collected row and clears it for the next label
+*/
+static void write_row(FILE *fpout) {
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (f > 0)
+            fputc(TAB, fpout);
+        write_cell(fpout, f);
+        free(cells[f]);
+        cells[f] = NULL;
+    }
+    fputc('\n', fpout);
+}
+
+int main(int argc, char *argv[]) {
+
+    Stream in;
+    FILE *fpout = stdout;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    long line_number = 0;
+    long rows = 0;
+    bool in_label = false;
+    char material[LRG] = {0};
+    int status = EXIT_SUCCESS;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s IDoc.txt [spreadsheet.txt]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // gzip-compressed IDocs are decompressed as they are read
+    if (stream_open_input(&in, argv[1]) != 0) {
+        fprintf(stderr, "File not found.\n");
+        return EXIT_FAILURE;
+    }
+    if (argc == 3 && (fpout = fopen(argv[2], "w")) == NULL) {
+        fprintf(stderr, "Could not open output file %s\n", argv[2]);
+        stream_close(&in);
+        return EXIT_FAILURE;
+    }
+
+    build_graphic_index();
+
+    for (int f = 0; f < FIELD_COUNT; f++)
+        fprintf(fpout, f > 0 ? "\t%s" : "%s", columns[f].column);
+    fputc('\n', fpout);
+
+    while ((line_len = getline(&line, &line_cap, in.fp)) >= 0) {
+        size_t len = (size_t) line_len;
+        line_number++;
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        if (strncmp(line, "Z2BTMH01000", SEGMENT_LEN) == 0 && len > DATA_OFFSET) {
+            snprintf(material, sizeof(material), "%.*s", (int) trimmed_len(line + DATA_OFFSET,
+                     len - DATA_OFFSET < KEY_LEN ? len - DATA_OFFSET : KEY_LEN), line + DATA_OFFSET);
+
+        } else if (strncmp(line, "Z2BTLH01000", SEGMENT_LEN) == 0 && len > DATA_OFFSET) {
+            if (in_label) {
+                write_row(fpout);
+                rows++;
+            }
+            in_label = true;
+            set_cell(FIELD_material, material, strlen(material));
+            set_cell(FIELD_label, line + DATA_OFFSET, trimmed_len(line + DATA_OFFSET,
+                     len - DATA_OFFSET < KEY_LEN ? len - DATA_OFFSET : KEY_LEN));
+
+        } else if (strncmp(line, "Z2BTTX01000", SEGMENT_LEN) == 0 && in_label) {
+            size_t offset = DATA_OFFSET + strlen(TDLINE_TAG) + strlen(cells[FIELD_label]) + TDLINE_INDENT;
+
+            // drop the '*' or '/' that ends every text line
+            if (len > offset)
+                append_cell(FIELD_tdline, line + offset, trimmed_len(line + offset, len - offset - 1));
+
+        } else if (strncmp(line, "Z2BTLC01000", SEGMENT_LEN) == 0 && in_label) {
+            if (decode_characteristic(line, len) != 0)
+                fprintf(stderr, "Unknown characteristic on line %ld.\n", line_number);
+
+        } else if (strncmp(line, "EDI_DC40", 8) != 0 && len > 0) {
+            fprintf(stderr, "Unexpected record on line %ld.\n", line_number);
+        }
+    }
+    if (in_label) {
+        write_row(fpout);
+        rows++;
+    }
+
+    if (stream_close(&in) != 0) {
+        fprintf(stderr, "Could not read \"%s\".\n", argv[1]);
+        status = EXIT_FAILURE;
+    }
+    if (fpout != stdout && fclose(fpout) != 0) {
+        fprintf(stderr, "Could not write output file %s\n", argv[2]);
+        status = EXIT_FAILURE;
+    }
+    free(line);
+
+    fprintf(stderr, "%ld labels written.\n", rows);
+    return status;
+}
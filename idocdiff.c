@@ -0,0 +1,413 @@
+/**
+ *  idocdiff.c compares two IDoc files label by label. Both IDocs are read
+ *  in a single streaming pass: idoc writes its labels sorted by label
+ *  number, so the two files are merged like two sorted lists and only one
+ *  label's records from each file are held in memory at a time. Sequence
+ *  numbers, control numbers and the control record timestamp are ignored.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+
+/* offsets and widths of the fixed-width IDoc record fields               */
+#define SEGMENT_LEN          11
+#define DATA_OFFSET          63
+#define KEY_LEN              18
+#define CHAR_NAME_OFFSET     63
+#define CHAR_VALUE_OFFSET    93
+#define CHAR_PATH_OFFSET    123
+#define CHAR_COL_LEN         30
+
+/* the TDLINE text follows this tag, the label and TDLINE_INDENT spaces    */
+#define TDLINE_TAG           "GRUNE  ENMATERIAL  "
+#define TDLINE_INDENT        61
+
+/* the control record's control number and timestamp, which are ignored    */
+#define CTRL_NUM_OFFSET      22
+#define CTRL_NUM_LEN          7
+#define TIMESTAMP_OFFSET    378
+#define TIMESTAMP_LEN        14
+
+/* exit codes, as diff uses them                                           */
+#define SAME                  0
+#define DIFFERENT             1
+#define TROUBLE               2
+
+/** a Z2BTLC characteristic record                                         */
+typedef struct {
+    char *name;
+    char *value;
+    char *path;
+} Characteristic;
+
+/** the records of one label, decoded                                      */
+typedef struct {
+    char *label;
+    char *material;
+    char **text;
+    int text_count;
+    int text_cap;
+    Characteristic *chars;
+    int char_count;
+    int char_cap;
+} Label_block;
+
+/** an IDoc being read, one label block at a time                          */
+typedef struct {
+    const char *filename;
+    Stream stream;
+    char *line;
+    size_t line_cap;
+    ssize_t line_len;
+    bool pending;
+    long line_number;
+    char *material;
+    char *control;
+    char *prev_label;
+} Idoc_reader;
+
+/**
+    copies a fixed-width field of a record, without its trailing spaces
+    @param line is the record
+    @param len is the length of the record
+    @param offset is the field's first column
+    @param width is the field's width, or 0 for the rest of the record
+    @return a dynamically allocated copy of the field
+*/
+static char *field_at(const char *line, size_t len, size_t offset, size_t width) {
+
+    size_t n = 0;
+    char *field;
+
+    if (offset < len)
+        n = (width == 0 || offset + width > len) ? len - offset : width;
+    while (n > 0 && line[offset + n - 1] == ' ')
+        n--;
+
+    if ((field = (char *) malloc(n + 1)) == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        exit(TROUBLE);
+    }
+    if (n > 0)
+        memcpy(field, line + offset, n);
+    field[n] = '\0';
+    return field;
+}
+
+static char *copy_string(const char *s) {
+    return field_at(s, strlen(s), 0, 0);
+}
+
+/**
+    doubles an array's capacity when it is full
+    @return the (possibly moved) array
+*/
+static void *grow(void *array, int count, int *cap, size_t size) {
+
+    if (count < *cap)
+        return array;
+    *cap = (*cap == 0) ? 16 : *cap * 2;
+    if ((array = realloc(array, (size_t) *cap * size)) == NULL) {
+        printf("Could not allocate memory. Exiting\n");
+        exit(TROUBLE);
+    }
+    return array;
+}
+
+static void clear_block(Label_block *block) {
+
+    free(block->label);
+    free(block->material);
+    for (int i = 0; i < block->text_count; i++)
+        free(block->text[i]);
+    for (int i = 0; i < block->char_count; i++) {
+        free(block->chars[i].name);
+        free(block->chars[i].value);
+        free(block->chars[i].path);
+    }
+    block->label = NULL;
+    block->material = NULL;
+    block->text_count = 0;
+    block->char_count = 0;
+}
+
+static void free_block(Label_block *block) {
+
+    clear_block(block);
+    free(block->text);
+    free(block->chars);
+}
+
+/**
+    reads the next record of an IDoc into the reader's line buffer, or
+    re-uses the record that ended the previous label block
+    @return true if a record was read
+*/
+static bool next_line(Idoc_reader *in) {
+
+    if (in->pending) {
+        in->pending = false;
+        return true;
+    }
+    if ((in->line_len = getline(&in->line, &in->line_cap, in->stream.fp)) < 0)
+        return false;
+
+    in->line_number++;
+    while (in->line_len > 0 && (in->line[in->line_len - 1] == '\n' || in->line[in->line_len - 1] == '\r'))
+        in->line[--in->line_len] = '\0';
+    return true;
+}
+
+/**
+    reads the records of the next label in an IDoc, from its Z2BTLH record
+    up to the next label's
+    @param in is the IDoc being read
+    @param block receives the label's records
+    @return 1 if a label was read, 0 at the end of the IDoc, -1 on error
+*/
+static int read_block(Idoc_reader *in, Label_block *block) {
+
+    clear_block(block);
+
+    while (next_line(in)) {
+        const char *line = in->line;
+        size_t len = (size_t) in->line_len;
+
+        if (strncmp(line, "EDI_DC40", 8) == 0) {
+            free(in->control);
+            in->control = field_at(line, len, 0, 0);
+
+        } else if (strncmp(line, "Z2BTMH01000", SEGMENT_LEN) == 0) {
+            free(in->material);
+            in->material = field_at(line, len, DATA_OFFSET, KEY_LEN);
+
+        } else if (strncmp(line, "Z2BTLH01000", SEGMENT_LEN) == 0) {
+            if (block->label != NULL) {
+                in->pending = true;
+                return 1;
+            }
+            block->label = field_at(line, len, DATA_OFFSET, KEY_LEN);
+            block->material = copy_string(in->material ? in->material : "");
+
+            if (in->prev_label != NULL && strcmp(block->label, in->prev_label) < 0) {
+                printf("%s is not sorted by label (\"%s\" follows \"%s\", line %ld).\n",
+                       in->filename, block->label, in->prev_label, in->line_number);
+                return -1;
+            }
+            free(in->prev_label);
+            in->prev_label = copy_string(block->label);
+
+        } else if (block->label == NULL) {
+            if (len > 0) {
+                printf("%s, line %ld: record outside of any label.\n", in->filename, in->line_number);
+                return -1;
+            }
+
+        } else if (strncmp(line, "Z2BTTX01000", SEGMENT_LEN) == 0) {
+            size_t offset = DATA_OFFSET + strlen(TDLINE_TAG) + strlen(block->label) + TDLINE_INDENT;
+
+            // the first text line ends in '*', the others in '/'
+            if (len > offset)
+                len--;
+            block->text = grow(block->text, block->text_count, &block->text_cap, sizeof(char *));
+            block->text[block->text_count++] = field_at(line, len, offset, 0);
+
+        } else if (strncmp(line, "Z2BTLC01000", SEGMENT_LEN) == 0) {
+            block->chars = grow(block->chars, block->char_count, &block->char_cap, sizeof(Characteristic));
+            Characteristic *c = &block->chars[block->char_count++];
+            c->name = field_at(line, len, CHAR_NAME_OFFSET, CHAR_COL_LEN);
+            c->value = field_at(line, len, CHAR_VALUE_OFFSET, CHAR_COL_LEN);
+            c->path = field_at(line, len, CHAR_PATH_OFFSET, 0);
+
+        } else if (len > 0) {
+            printf("%s, line %ld: unknown segment \"%.*s\".\n", in->filename, in->line_number, SEGMENT_LEN, line);
+            return -1;
+        }
+    }
+    return block->label != NULL;
+}
+
+/**
+    compares the control records of both IDocs, ignoring their control
+    numbers and timestamps
+    @return true if they match
+*/
+static bool same_control(const char *a, const char *b) {
+
+    size_t len = strlen(a);
+
+    if (len != strlen(b))
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (i >= CTRL_NUM_OFFSET && i < CTRL_NUM_OFFSET + CTRL_NUM_LEN)
+            continue;
+        if (i >= TIMESTAMP_OFFSET && i < TIMESTAMP_OFFSET + TIMESTAMP_LEN)
+            continue;
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+static const Characteristic *find_char(const Label_block *block, const char *name) {
+
+    for (int i = 0; i < block->char_count; i++)
+        if (strcmp(block->chars[i].name, name) == 0)
+            return &block->chars[i];
+    return NULL;
+}
+
+/**
+    reports every difference between two versions of the same label
+    @return true if the label changed
+*/
+static bool compare_blocks(const Label_block *a, const Label_block *b) {
+
+    bool changed = false;
+
+#define CHANGED() do { if (!changed) { printf("~ %s\n", a->label); changed = true; } } while (0)
+
+    if (strcmp(a->material, b->material) != 0) {
+        CHANGED();
+        printf("    MATERIAL: \"%s\" -> \"%s\"\n", a->material, b->material);
+    }
+
+    int lines = a->text_count > b->text_count ? a->text_count : b->text_count;
+    for (int i = 0; i < lines; i++) {
+        const char *ta = i < a->text_count ? a->text[i] : NULL;
+        const char *tb = i < b->text_count ? b->text[i] : NULL;
+
+        if (ta && tb && strcmp(ta, tb) == 0)
+            continue;
+        CHANGED();
+        if (ta == NULL)
+            printf("  + TDLINE %d: \"%s\"\n", i + 1, tb);
+        else if (tb == NULL)
+            printf("  - TDLINE %d: \"%s\"\n", i + 1, ta);
+        else
+            printf("    TDLINE %d: \"%s\" -> \"%s\"\n", i + 1, ta, tb);
+    }
+
+    for (int i = 0; i < a->char_count; i++) {
+        const Characteristic *ca = &a->chars[i];
+        const Characteristic *cb = find_char(b, ca->name);
+
+        if (cb == NULL) {
+            CHANGED();
+            printf("  - %s: \"%s\"\n", ca->name, ca->value);
+        } else if (strcmp(ca->value, cb->value) != 0) {
+            CHANGED();
+            printf("    %s: \"%s\" -> \"%s\"\n", ca->name, ca->value, cb->value);
+        } else if (strcmp(ca->path, cb->path) != 0) {
+            CHANGED();
+            printf("    %s: \"%s\" graphic \"%s\" -> \"%s\"\n", ca->name, ca->value, ca->path, cb->path);
+        }
+    }
+    for (int i = 0; i < b->char_count; i++) {
+        if (find_char(a, b->chars[i].name) == NULL) {
+            CHANGED();
+            printf("  + %s: \"%s\"\n", b->chars[i].name, b->chars[i].value);
+        }
+    }
+
+#undef CHANGED
+
+    return changed;
+}
+
+static int open_reader(Idoc_reader *in, const char *filename) {
+
+    memset(in, 0, sizeof(*in));
+    in->filename = filename;
+    if (stream_open_input(&in->stream, filename) != 0) {
+        printf("Could not open \"%s\".\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_reader(Idoc_reader *in) {
+
+    stream_close(&in->stream);
+    free(in->line);
+    free(in->material);
+    free(in->control);
+    free(in->prev_label);
+}
+
+int main(int argc, char *argv[]) {
+
+    Idoc_reader old_in, new_in;
+    Label_block old_block = {0}, new_block = {0};
+    long added = 0, removed = 0, changed = 0, unchanged = 0;
+    int status = SAME;
+
+    if (argc != 3) {
+        printf("usage: %s old_IDoc.txt new_IDoc.txt\n", argv[0]);
+        return TROUBLE;
+    }
+
+    // gzip-compressed IDocs are decompressed as they are read
+    if (open_reader(&old_in, argv[1]) != 0)
+        return TROUBLE;
+    if (open_reader(&new_in, argv[2]) != 0) {
+        close_reader(&old_in);
+        return TROUBLE;
+    }
+
+    int has_old = read_block(&old_in, &old_block);
+    int has_new = read_block(&new_in, &new_block);
+
+    if (old_in.control && new_in.control && !same_control(old_in.control, new_in.control)) {
+        printf("~ control record\n");
+        status = DIFFERENT;
+    }
+
+    // merge the two sorted label sequences
+    while (has_old > 0 || has_new > 0) {
+        int cmp;
+
+        if (has_old < 0 || has_new < 0)
+            break;
+        if (has_old == 0)
+            cmp = 1;
+        else if (has_new == 0)
+            cmp = -1;
+        else
+            cmp = strcmp(old_block.label, new_block.label);
+
+        if (cmp < 0) {
+            printf("- %s\n", old_block.label);
+            removed++;
+            has_old = read_block(&old_in, &old_block);
+        } else if (cmp > 0) {
+            printf("+ %s\n", new_block.label);
+            added++;
+            has_new = read_block(&new_in, &new_block);
+        } else {
+            if (compare_blocks(&old_block, &new_block))
+                changed++;
+            else
+                unchanged++;
+            has_old = read_block(&old_in, &old_block);
+            has_new = read_block(&new_in, &new_block);
+        }
+    }
+
+    if (has_old < 0 || has_new < 0)
+        status = TROUBLE;
+    else if (added || removed || changed)
+        status = DIFFERENT;
+
+    printf("\n%ld labels added, %ld removed, %ld changed, %ld unchanged.\n", added, removed, changed, unchanged);
+
+    free_block(&old_block);
+    free_block(&new_block);
+    close_reader(&old_in);
+    close_reader(&new_in);
+
+    return status;
+}
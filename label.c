@@ -35,55 +35,26 @@ int spreadsheet_expand() {
 
 char *get_token(char *buffer, char tab_str) {
     char *delimiter;
-    int buffer_len = (int) strlen(buffer);
-    char *token = (char *) malloc(MAX_COLUMNS * sizeof(char));
-
-    if ((delimiter = strchr(buffer, tab_str)) != NULL) {
-        delimiter++;
-        int c = 0;
-        for (char *i = buffer; i < delimiter - 1; i++) {
-            token[c++] = *i;
-        }
-        token[c] = '\0';
-        int delimiter_len = (int) (delimiter - buffer);
-        memmove(buffer, delimiter, (size_t) (buffer_len - delimiter_len + 1));
-        // buffer_len = strlen(buffer);
-    } else if (buffer_len > 0) { // get last token
-        int c = 0;
-        char *cp = buffer;
-        while (*cp) {
-            token[c++] = *cp;
-            cp++;
-        }
-        token[c] = '\0';
-        buffer[0] = '\0';
-        // buffer_len = 0;
-    }
-
-    return token;
-}
-
-/**
-    returns the position of the nth occurrence of a delimiter in a char array
-*/
-int peek_nth_token(int n, const char *buffer, char delimiter) {
+    size_t buffer_len = strlen(buffer);
+    size_t token_len;
+    char *token;
 
-    if (n == 0)
-        return 0;
+    if ((delimiter = strchr(buffer, tab_str)) != NULL)
+        token_len = (size_t) (delimiter - buffer);
+    else
+        token_len = buffer_len;
 
-    int i = 0;
-    int hit_count = 0;
-    int length = (int) strlen(buffer);
+    if ((token = (char *) malloc(token_len + 1)) == NULL)
+        return NULL;
+    memcpy(token, buffer, token_len);
+    token[token_len] = '\0';
 
-    while ((i < length) && (hit_count < n)) {
-        if (buffer[i] == delimiter)
-            hit_count++;
-        i++;
-    }
-    if (hit_count == n)
-        return i - 1;
+    if (delimiter != NULL)
+        memmove(buffer, delimiter + 1, buffer_len - token_len);
+    else
+        buffer[0] = '\0';
 
-    return -1;
+    return token;
 }
 
 /*
@@ -132,57 +103,119 @@ int strncmpci(const char *str1, const char *str2, int num) {
     return ret_code;
 }
 
-int equals_yes(char *field) {
+int equals_yes(const char *field) {
     return ((strcasecmp(field, "Y") == 0) || (strcasecmp(field, "Yes") == 0));
 }
 
-int equals_no(char *field) {
+int equals_no(const char *field) {
     return ((strcasecmp(field, "N") == 0) || (strcasecmp(field, "NO") == 0));
 }
 
-int get_field_contents_from_row(char *contents, int i, int count, char tab_str) {
+Cell_tag classify_cell(const char *text) {
 
-    int start = 0;
-    int stop = 0;
+    Cell_tag tag = {CELL_EMPTY, 0};
+    bool digits = true, space = false;
+    size_t len = 0;
 
-    if (count == 0)
-        start = 0;
-    else if ((start = peek_nth_token(count, spreadsheet[i], tab_str)) == -1)
-        start = (int) strlen(spreadsheet[i]);
+    for (; text[len] != '\0'; len++) {
+        digits = digits && text[len] >= '0' && text[len] <= '9';
+        space = space || text[len] == ' ';
+    }
+    tag.length = (unsigned char) (len > UCHAR_MAX ? UCHAR_MAX : len);
+    if (len == 0)
+        return tag;
+
+    // only cells of one to three characters can be a Y / N or n/a word
+    if (digits)
+        tag.kind = CELL_NUMERIC;
+    else if ((len == 1 && (text[0] == 'Y' || text[0] == 'y')) || (len == 3 && strcasecmp(text, "Yes") == 0))
+        tag.kind = CELL_YES;
+    else if ((len == 1 && (text[0] == 'N' || text[0] == 'n')) || (len == 2 && strcasecmp(text, "NO") == 0))
+        tag.kind = CELL_NO;
+    else if (len == 3 && strcasecmp(text, "n/a") == 0)
+        tag.kind = CELL_NA;
     else
-        start++;
+        tag.kind = CELL_TEXT;
 
-    if ((stop = peek_nth_token(count + 1, spreadsheet[i], tab_str)) == -1)
-        stop = (int) strlen(spreadsheet[i]);
+    if (space)
+        tag.kind |= CELL_SPACE;
+    return tag;
+}
 
-    int length = stop - start;
-    strncpy(contents, spreadsheet[i] + start, (size_t) length);
-    contents[length] = '\0';
+size_t unquote_field(char *field) {
 
-    // check if there's an .tif extension and remove it if so
-    if ((length > 4) && ((contents[length - 4]) == '.')) {
-        char *suffix = contents + length - 3;
-        if (strcmp(suffix, "tif") == 0)
-            contents[length - 4] = '\0';
+    char *src = field;
+    char *end = field + strlen(field);
+    char *dst = field;
+
+    // drop any leading...
+    if (src < end && *src == '\"')
+        src++;
+
+    // ...and/or trailing quote
+    if (src < end && *(end - 1) == '\"')
+        end--;
+
+    // and collapse each doubled quote to a single quote
+    while (src < end) {
+        if (*src == '\"' && src + 1 < end && *(src + 1) == '\"')
+            src++;
+        *dst++ = *src++;
     }
+    *dst = '\0';
 
-    if (equals_no(contents))
-        return 0;
-    else
-        return length;
+    return (size_t) (dst - field);
+}
+
+int split_tdline(Label_record *label, const char *text) {
+
+    size_t length = strlen(text);
+    int max_segments = (int) (length / 2) + 1;
+    const char *cp = text;
+    char *out;
+    int n = 0;
+
+    // every segment gets its own terminator, so the text grows by one byte each
+    label->tdline = (char *) malloc(length + (size_t) max_segments + 1);
+    label->tdline_segments = (char **) malloc(max_segments * sizeof(char *));
+    if (label->tdline == NULL || label->tdline_segments == NULL) {
+        free(label->tdline);
+        free(label->tdline_segments);
+        label->tdline = NULL;
+        label->tdline_segments = NULL;
+        label->tdline_count = 0;
+        return -1;
+    }
+
+    out = label->tdline;
+    while (*cp) {
+        const char *dpos = strstr(cp, "##");
+
+        // a segment keeps its "##" terminator; the last one may have none
+        size_t segment_len = (dpos != NULL) ? (size_t) (dpos - cp) + 2 : strlen(cp);
+
+        label->tdline_segments[n++] = out;
+        memcpy(out, cp, segment_len);
+        out[segment_len] = '\0';
+        out += segment_len + 1;
+        cp += segment_len;
+    }
+    label->tdline_count = n;
+    return n;
 }
 
 int duplicate_column_names(const char *cols) {
 
-    char buffer[MAX_COLUMNS];
+    char *buffer;
     unsigned short count = 0;
     char tab_str = TAB;
     char **column_names;
+    char *temp;
 
-    char min_column[MED], temp[MED];
-    bool sorted = true;
     int return_code = 0;
 
+    if ((buffer = (char *) malloc(strlen(cols) + 1)) == NULL)
+        return -1;
     strcpy(buffer, cols);
 
     // create an array of column names
@@ -193,30 +226,26 @@ int duplicate_column_names(const char *cols) {
         char *token = get_token(buffer, tab_str);
         if (strlen(token)) {
             column_names = (char **) realloc(column_names, sizeof(char *) + count * sizeof(char *));
-            column_names[count] = (char *) malloc(sizeof(char *) + sizeof(token) + 1);
-            strcpy(column_names[count], token);
+            column_names[count] = token;
             count++;
+        } else
             free(token);
-        }
     }
+    free(buffer);
 
     // sort the list
     for (int i = 0; i < count; i++) {
         int min_index = i;
-        strcpy(min_column, column_names[i]);
 
         for (int j = i + 1; j < count; j++) {
-            if (strcmp(column_names[j], min_column) < 0) {
-                strcpy(min_column, column_names[j]);
+            if (strcmp(column_names[j], column_names[min_index]) < 0)
                 min_index = j;
-            }
         }
 
         if (i != min_index) {
-            strcpy(temp, column_names[i]);
-            strcpy(column_names[i], column_names[min_index]);
-            strcpy(column_names[min_index], temp);
-            sorted = false;
+            temp = column_names[i];
+            column_names[i] = column_names[min_index];
+            column_names[min_index] = temp;
         }
     }
 
@@ -232,606 +261,187 @@ int duplicate_column_names(const char *cols) {
 }
 
 
-int parse_spreadsheet(char *buffer, Label_record *labels) {
-    unsigned short count = 0;
-    bool material = 0;
-    bool pcode = 0;
-
-    char tab_str = TAB;
-    char contents[MAX_COLUMNS];
-
-    while (strlen(buffer) > 0) {
-
-        // Keep extracting tokens while the delimiter is present in buffer
-        char *token = get_token(buffer, tab_str);
-
-        if (strcmp(token, "LABEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].label, contents, sizeof(labels[i].label));
-            }
-        } else if ((strcmp(token, "MATERIAL") == 0) ||
-                   (strcmp(token, "PCODE") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].material, contents, sizeof(labels[i].material));
-            }
-            if (strcmp(token, "MATERIAL") == 0)
-                material = true;
-            else {
-                pcode = true;
-                printf("Column \"PCODE\" subsituted for \"MATERIAL\"\n");
-            }
-            if (pcode && material) {
-                printf("Found both \"MATERIAL\" and \"PCODE\" column headings. Eliminate one of these.\n");
-                return -1;
-            }
-
-        } else if (strcmp(token, "TDLINE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].tdline = (char *) malloc(strlen(contents) + 1);
-                strlcpy(labels[i].tdline, contents, sizeof(contents));
-            }
-        } else if (strcmp(token, "ADDRESS") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].address, contents, sizeof(labels[i].address));
-            }
-
-        } else if (strcmp(token, "BARCODETEXT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].barcodetext, contents, sizeof(labels[i].barcodetext));
-            }
-
-        } else if (strcmp(token, "BARCODE1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].barcode1, contents, sizeof(labels[i].barcode1));
-            }
-
-        } else if (strcmp(token, "GS1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].gs1, contents, sizeof(labels[i].gs1));
-            }
-
-        } else if (strcmp(token, "GTIN") == 0) {
-            if (non_SAP_fields) {
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].gtin, contents, sizeof(labels[i].gtin));
-                }
-            } else
-                printf("Ignoring column \"%s\"\n", token);
-
-
-        } else if (strcmp(token, "BOMLEVEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].bomlevel, contents, sizeof(labels[i].bomlevel));
-            }
-
-        } else if (strcmp(token, "CAUTION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].caution = 2;
-                else if (equals_no(contents))
-                    labels[i].caution = 1;
-            }
-
-        } else if (strcmp(token, "CAUTIONSTATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].cautionstatement, contents, sizeof(labels[i].cautionstatement));
-            }
-
-        } else if (strcmp(token, "CE0120") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].cemark, contents, sizeof(labels[i].cemark));
-            }
-
-        } else if (strcmp(token, "CONSULTIFU") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].consultifu = 2;
-                else if (equals_no(contents))
-                    labels[i].consultifu = 1;
-            }
-
-        } else if (strcmp(token, "CONTAINSLATEX") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].latex = 2;
-                else if (equals_no(contents))
-                    labels[i].latex = 1;
-            }
-
-        } else if (strcmp(token, "COOSTATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].coostate, contents, sizeof(labels[i].coostate));
-            }
-
-        } else if (strcmp(token, "DESCRIPTION") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].description, contents, sizeof(labels[i].description));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "DISTRIBUTEDBY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].distby, contents, sizeof(labels[i].distby));
-            }
+/* where each storage kind keeps its value in the Label_record            */
+#define FIELD_PLACE_STORE_STRING(member) offsetof(Label_record, member), sizeof(((Label_record *) 0)->member), -1
+#define FIELD_PLACE_STORE_LOOKUP(member) FIELD_PLACE_STORE_STRING(member)
+#define FIELD_PLACE_STORE_GTIN(member)   FIELD_PLACE_STORE_STRING(member)
+#define FIELD_PLACE_STORE_FLAG(member)   offsetof(Label_record, flags), 0, FLAG_##member
+#define FIELD_PLACE_STORE_TEXT(member)   offsetof(Label_record, member), 0, -1
 
-        } else if ((strcmp(token, "DONOTUSEDAM") == 0) ||
-                (strcmp(token, "DONOTPAKDAM") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].donotusedamaged = 2;
-                else if (equals_no(contents))
-                    labels[i].donotusedamaged = 1;
-            }
+#define FIELD_DEF(member, column, alias, store, emit, size, graphic, attrs) \
+    {column, alias, store, emit, FIELD_PLACE_##store(member), graphic, attrs},
 
-        } else if (strcmp(token, "ECREP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].ecrep = 2;
-                else if (equals_no(contents))
-                    labels[i].ecrep = 1;
-            }
+const Field_def label_fields[FIELD_COUNT] = {
+    LABEL_FIELDS(FIELD_DEF)
+};
 
-        } else if (strcmp(token, "ECREPADDRESS") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].ecrepaddress, contents, sizeof(labels[i].ecrepaddress));
-            }
+const Field_def *find_field(const char *column) {
 
-        } else if (strcmp(token, "ELECTROSURIFU") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].electroifu = 2;
-                else if (equals_no(contents))
-                    labels[i].electroifu = 1;
-            }
-
-        } else if (strcmp(token, "EXPDATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].expdate = 2;
-                else if (equals_no(contents))
-                    labels[i].expdate = 1;
-            }
-
-        } else if (strcmp(token, "FLGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].flgraphic, contents, sizeof(labels[i].flgraphic));
-            }
-
-        } else if (strcmp(token, "KEEPAWAYHEAT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].keepawayheat = 2;
-                else if (equals_no(contents))
-                    labels[i].keepawayheat = 1;
-            }
-
-        } else if (strcmp(token, "INSERTGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].insertgraphic, contents, sizeof(labels[i].insertgraphic));
-            }
-
-        } else if (strcmp(token, "KEEPDRY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].keepdry = 2;
-            }
-
-        } else if (strcmp(token, "LABELGRAPH1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].labelgraph1, contents, sizeof(labels[i].labelgraph1));
-            }
-
-        } else if (strcmp(token, "LABELGRAPH2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].labelgraph2, contents, sizeof(labels[i].labelgraph2));
-            }
-
-        } else if (strcmp(token, "LATEXFREE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].latexfree = 2;
-                else if (equals_no(contents))
-                    labels[i].latexfree = 1;
-            }
-
-        } else if (strcmp(token, "LATEXSTATEMENT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].latexstatement, contents, sizeof(labels[i].latexstatement));
-            }
-
-        } else if (strcmp(token, "LEVEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].level, contents, sizeof(labels[i].level));
-            }
-
-        } else if (strcmp(token, "LOGO1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo1, contents, sizeof(labels[i].logo1));
-            }
-
-        } else if (strcmp(token, "LOGO2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo2, contents, sizeof(labels[i].logo2));
-            }
-
-        } else if (strcmp(token, "LOGO3") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo3, contents, sizeof(labels[i].logo3));
-            }
-
-        } else if (strcmp(token, "LOGO4") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo4, contents, sizeof(labels[i].logo4));
-            }
-
-        } else if (strcmp(token, "LOGO5") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo5, contents, sizeof(labels[i].logo5));
-            }
-
-        } else if (strcmp(token, "MDR1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr1, contents, sizeof(labels[i].mdr1));
-            }
-
-        } else if (strcmp(token, "MDR2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr2, contents, sizeof(labels[i].mdr2));
-            }
-
-        } else if (strcmp(token, "MDR3") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr3, contents, sizeof(labels[i].mdr3));
-            }
-
-        } else if (strcmp(token, "MDR4") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr4, contents, sizeof(labels[i].mdr4));
-            }
-
-        } else if (strcmp(token, "MDR5") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                if (get_field_contents_from_row(contents, i, count, tab_str)) {
-                    strlcpy(labels[i].mdr5, contents, sizeof(labels[i].mdr5));
-                }
-            }
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (strcmp(column, label_fields[f].column) == 0)
+            return &label_fields[f];
+        if (label_fields[f].alias && strcmp(column, label_fields[f].alias) == 0)
+            return &label_fields[f];
+    }
+    return NULL;
+}
 
-        } else if (strcmp(token, "LOTGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].lotgraphic = 2;
-                } else if (equals_no(contents))
-                    labels[i].lotgraphic = 1;
-            }
-        } else if (strcmp(token, "LTNUMBER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strncpy(labels[i].ltnumber, contents, sizeof(labels[0].ltnumber));
-            }
+/**
+    copies one cell into its label record field, as the field's storage
+    kind requires, classifying it on the way
+    @param label is the label record being filled
+    @param field is the schema entry of the cell's column
+    @param contents is the cell, with any ".tif" extension already removed
+*/
+static void store_field(Label_record *label, const Field_def *field, char *contents) {
 
-        } else if (strcmp(token, "IPN") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strncpy(labels[i].ipn, contents, sizeof(labels[0].ipn));
-            }
+    Cell_tag tag;
 
-        } else if (strcmp(token, "MANINBOX") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].maninbox = 2;
-                else if (equals_no(contents))
-                    labels[i].maninbox = 1;
-            }
-        } else if (strcmp(token, "MANUFACTUREDBY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].manufacturedby, contents, sizeof(labels[i].manufacturedby));
-            }
+    switch (field->store) {
+        case STORE_FLAG:
+            tag = classify_cell(contents);
+            if (cell_class(tag) == CELL_YES)
+                label->flags = (label->flags & ~FLAG_NO(field->flag)) | FLAG_YES(field->flag);
+            else if (cell_class(tag) == CELL_NO)
+                label->flags = (label->flags & ~FLAG_YES(field->flag)) | FLAG_NO(field->flag);
+            break;
 
-        } else if (strcmp(token, "MANUFACTURER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].manufacturer = 2;
-                } else if (equals_no(contents))
-                    labels[i].manufacturer = 1;
-            }
-        } else if (strcmp(token, "MFGDATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].mfgdate = 2;
-                } else if (equals_no(contents))
-                    labels[i].mfgdate = 1;
-            }
-        } else if (strcmp(token, "NORESTERILE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].noresterilize = 2;
-                } else if (equals_no(contents))
-                    labels[i].noresterilize = 1;
-            }
-        } else if (strcmp(token, "NONSTERILE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].nonsterile = 2;
-                } else if (equals_no(contents))
-                    labels[i].nonsterile = 1;
-            }
-        } else if (strcmp(token, "OLDLABEL") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].oldlabel, contents, sizeof(labels[i].oldlabel));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "OLDTEMPLATE") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].oldtemplate, contents, sizeof(labels[i].oldtemplate));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "PREVLABEL") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].prevlabel, contents, sizeof(labels[i].prevlabel));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "PREVTEMPLATE") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].prevtemplate, contents, sizeof(labels[i].prevtemplate));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "PATENTSTA") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].patentstatement, contents, sizeof(labels[i].patentstatement));
+        case STORE_TEXT:
+            // blank, "N" and "n/a" cells carry no text lines
+            tag = classify_cell(contents);
+            if (cell_class(tag) != CELL_EMPTY && cell_class(tag) != CELL_NA && cell_class(tag) != CELL_NO) {
+                unquote_field(contents);
+                split_tdline(label, contents);
             }
+            break;
 
-        } else if (strcmp(token, "PHTDEHP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].phtdehp = 2;
-                } else if (equals_no(contents))
-                    labels[i].phtdehp = 1;
-            }
+        default:
+            if (field->attrs & ATTR_QUOTED)
+                unquote_field(contents);
+            strlcpy(field_text(label, field), contents, field->size);
 
-        } else if (strcmp(token, "PHTBBP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].phtbbp = 2;
-                } else if (equals_no(contents))
-                    labels[i].phtbbp = 1;
-            }
+            // the tag describes the text as stored, after any truncation
+            tag = classify_cell(field_text(label, field));
+            label->tags[field - label_fields] = tag;
+            break;
+    }
+}
 
-        } else if (strcmp(token, "PHTDINP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].phtdinp = 2;
-                else if (equals_no(contents))
-                    labels[i].phtdinp = 1;
-            }
+int plan_columns(char *buffer, const Field_def ***plan) {
+    int count = 0;
+    char tab_str = TAB;
+    const char *seen[FIELD_COUNT] = {0};
 
-        } else if (strcmp(token, "PVCFREE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].pvcfree = 2;
-                else if (equals_no(contents))
-                    labels[i].pvcfree = 1;
-            }
-        } else if (strcmp(token, "QUANTITY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].quantity, contents, sizeof(labels[i].quantity));
-            }
+    *plan = NULL;
+    while (strlen(buffer) > 0) {
 
-        } else if (strcmp(token, "REF") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].ref = 2;
-                } else if (equals_no(contents))
-                    labels[i].ref = 1;
+        // Keep extracting tokens while the delimiter is present in buffer
+        char *token = get_token(buffer, tab_str);
+        const Field_def *field = find_field(token);
+
+        if (field && !wanted_fields[field - label_fields])
+            field = NULL;
+
+        if (field) {
+            int f = (int) (field - label_fields);
+            if (seen[f]) {
+                printf("Found both \"%s\" and \"%s\" column headings. Eliminate one of these.\n", seen[f], token);
+                free(token);
+                free(*plan);
+                *plan = NULL;
+                return -1;
             }
+            seen[f] = (strcmp(token, field->column) == 0) ? field->column : field->alias;
+            if (seen[f] != field->column)
+                printf("Column \"%s\" subsituted for \"%s\"\n", field->alias, field->column);
 
-        } else if (strcmp(token, "REFNUMBER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].refnumber = 2;
-                } else if (equals_no(contents))
-                    labels[i].refnumber = 1;
-            }
+        } else if (strlen(token) > 0) {
+            if (strcmp(token, "CAUTIONSTATEMENT") == 0)
+                printf("Change \"%s\" to \"CAUTIONSTATE.\" ", token);
+            printf("Ignoring column \"%s\"\n", token);
+        }
 
-        } else if (strcmp(token, "REUSABLE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].reusable = 2;
-                } else if (equals_no(contents))
-                    labels[i].reusable = 1;
-            }
-        } else if (strcmp(token, "REVISION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].revision, contents, sizeof(labels[i].revision));
-            }
+        const Field_def **temp = (const Field_def **) realloc(*plan, (count + 1) * sizeof(**plan));
+        if (temp == NULL) {
+            free(token);
+            free(*plan);
+            *plan = NULL;
+            return -1;
+        }
+        *plan = temp;
+        (*plan)[count++] = field;
+        free(token);
+    }
+    return count;
+}
 
-        } else if (strcmp(token, "RXONLY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].rxonly = 2;
-                } else if (equals_no(contents))
-                    labels[i].rxonly = 1;
-            }
+int parse_rows(const Field_def **plan, int count, char **rows, int row_count, Label_record *labels) {
+    char tab_str = TAB;
 
-        } else if (strcmp(token, "SINGLEUSE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].singleuseonly = 2;
-                } else if (equals_no(contents))
-                    labels[i].singleuseonly = 1;
-            }
+    // no cell can be longer than the widest row
+    char *contents = (char *) malloc(spreadsheet_width + 1);
+    if (contents == NULL)
+        return -1;
 
-        } else if (strcmp(token, "SERIAL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].serial = 2;
-                } else if (equals_no(contents))
-                    labels[i].serial = 1;
-            }
+    // the columns after the last one a field maps to are never walked
+    int used = count;
+    while (used > 0 && plan[used - 1] == NULL)
+        used--;
 
-        } else if (strcmp(token, "SINGLEPATIENTUSE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].singlepatientuse = 2;
-                } else if (equals_no(contents))
-                    labels[i].singlepatientuse = 1;
-            }
+    // walk each row once, handing every cell to the field its column maps to
+    for (int i = 1; i < row_count; i++) {
+        const char *cell = rows[i];
 
-        } else if (strcmp(token, "SIZE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].size, contents, sizeof(labels[i].size));
-            }
+        for (int col = 0; col < used && *cell; col++) {
+            const char *end = strchr(cell, tab_str);
+            size_t length = (end != NULL) ? (size_t) (end - cell) : strlen(cell);
 
-        } else if (strcmp(token, "SIZELOGO") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].sizelogo = 2;
-                } else if (equals_no(contents))
-                    labels[i].sizelogo = 1;
-            }
+            if (plan[col] != NULL) {
+                memcpy(contents, cell, length);
+                contents[length] = '\0';
 
-        } else if (strcmp(token, "STERILITYTYPE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].sterilitytype, contents, sizeof(labels[i].sterilitytype));
-            }
+                // check if there's an .tif extension and remove it if so
+                if ((length > 4) && (memcmp(contents + length - 4, ".tif", 4) == 0))
+                    contents[length - 4] = '\0';
 
-        } else if (strcmp(token, "STERILESTA") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].sterilitystatement, contents, sizeof(labels[i].sterilitystatement));
+                store_field(&labels[i], plan[col], contents);
             }
+            cell += length;
+            if (*cell == tab_str)
+                cell++;
+        }
+    }
 
-        } else if (strcmp(token, "TEMPRANGE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].temprange, contents, sizeof(labels[i].temprange));
-            }
+    free(contents);
+    return 0;
+}
 
-        } else if ((strcmp(token, "TEMPLATENUMBER") == 0) ||
-                   (strcmp(token, "TEMPLATE") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].template, contents, sizeof(labels[i].template));
-            }
+int parse_spreadsheet(char *buffer, Label_record *labels) {
 
-        } else if (strcmp(token, "TFXLOGO") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents)) {
-                    labels[i].tfxlogo = 2;
-                } else if (equals_no(contents))
-                    labels[i].tfxlogo = 1;
-            }
+    // the schema field of each column, or NULL if the column is ignored
+    const Field_def **plan;
+    int count = plan_columns(buffer, &plan);
 
-        } else if (strcmp(token, "VERSION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].version, contents, sizeof(labels[i].version));
-            }
-        } else {
-            if (strlen(token) > 0) {
-                if (strcmp(token, "CAUTIONSTATEMENT") == 0)
-                    printf("Change \"%s\" to \"CAUTIONSTATE.\" ", token);
-                printf("Ignoring column \"%s\"\n", token);
-            }
-        }
-        count++;
-        free(token);
-    }
+    if (count != -1 && parse_rows(plan, count, spreadsheet, spreadsheet_row_number, labels) != 0)
+        count = -1;
+    free(plan);
     return count;
 }
 
 int sort_labels(Label_record *labels) {
+    return sort_label_range(labels, 1, spreadsheet_row_number);
+}
+
+int sort_label_range(Label_record *labels, int first, int end) {
 
     Label_record min_label;
     bool sorted = true;
 
-    for (int i = 1; i < spreadsheet_row_number; i++) {
+    for (int i = first; i < end; i++) {
         int min_index = i;
         min_label = labels[i];
 
-        for (int j = i + 1; j < spreadsheet_row_number; j++) {
+        for (int j = i + 1; j < end; j++) {
             if (strcmp(labels[j].label, min_label.label) < 0) {
                 min_label = labels[j];
                 min_index = j;
@@ -9,11 +9,14 @@
 #define LABEL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* the spreadsheet's initial capacity */
 #define INITIAL_CAP             3
 
-#define MAX_COLUMNS          1000
+/* the spreadsheet line buffer's initial capacity; it grows as needed   */
+#define INITIAL_ROW_WIDTH    1024
 
 /* Field lengths                     */
 #define LRG                    41
@@ -34,111 +37,317 @@
 
 #define TAB                  '\t'
 
+/* the number of spaces to indent the TDline lines                       */
+#define TDLINE_INDENT  61
+
+/* normal graphics folder path                                           */
+#define GRAPHICS_PATH  "T:\\MEDICAL\\NA\\RTP\\TEAM CENTER\\TEMPLATES\\GRAPHICS\\"
+
+/* alternate graphics folder path                                        */
+#define ALT_GRAPHICS_PATH  "C:\\Users\\jkottiel\\Documents\\1 - Teleflex\\Labeling Resources\\Personal Graphics\\"
+
+/* width of the graphic path portion of a characteristic record          */
+#define GRAPHIC_PATH_LEN  255
+
+/* width of a characteristic record's name and value columns             */
+#define CHAR_COL_LEN       30
+
 /** global variable spreadsheet that holds the label records  */
 extern char **spreadsheet;
 extern int spreadsheet_cap;
 extern int spreadsheet_row_number;
+extern size_t spreadsheet_width;
 
 /* whether or not to include non-SAP fields in IDoc                      */
 extern bool non_SAP_fields;
 
+/* if the -F command line parameter is present, F_ is activated          */
+//#define F_ "F_"
+#define F_ ""
+
+/* how a label field is stored in the Label_record                       */
+typedef enum {
+    STORE_STRING,       /* fixed-length text copied from the cell             */
+    STORE_LOOKUP,       /* text that is checked against the SAP lookup array  */
+    STORE_GTIN,         /* text holding a GTIN that is validated on output    */
+    STORE_FLAG,         /* Y / N cell: 2 if yes, 1 if no, 0 if neither        */
+    STORE_TEXT          /* TDLINE text, decoded and split into segments       */
+} Store_kind;
+
+/* which IDoc record(s) a label field produces                           */
+typedef enum {
+    EMIT_MATERIAL,      /* Z2BTMH01000 record whenever the material changes   */
+    EMIT_LABEL,         /* Z2BTLH01000 record; the label must start with LBL  */
+    EMIT_TDLINE,        /* one Z2BTTX01000 record per TDLINE segment          */
+    EMIT_INFO,          /* characteristic naming its value; "N" prints "NO"   */
+    EMIT_VALUE,         /* like EMIT_INFO, but skipped when the cell is "N"   */
+    EMIT_REVISION,      /* characteristic whose value must be R0 - R99        */
+    EMIT_GRAPHIC0X,     /* GRAPHIC01 - GRAPHIC14 characteristic if flag is Y  */
+    EMIT_BOOLEAN,       /* Y / N characteristic with a fixed graphic          */
+    EMIT_BOOLEAN_HEADER,/* Y / N characteristic printing "Yes" or "No"        */
+    EMIT_GRAPHIC,       /* characteristic whose value names a graphic         */
+    EMIT_GS1            /* graphic characteristic, blank if value has spaces  */
+} Emit_kind;
+
+/* field attributes                                                      */
+#define ATTR_NON_SAP          0x01   /* printed only with [-n]              */
+#define ATTR_QUOTED           0x02   /* cell quotes are decoded at ingest   */
+#define ATTR_STANDARD         0x04   /* value should be in the lookup array */
+
 /**
+    LABEL_FIELDS is the schema of the spreadsheet columns, listed in the
+    order their records appear in the IDoc. It generates the Label_record
+    struct, the column dispatch in parse_spreadsheet() and the emitter loop
+    in print_label_idoc_records(). Each entry reads
+
+    X(member, column, alias, storage, emit, size, graphic, attributes)
 
+    where graphic is the file printed for a yes flag, or the value printed
+    for a yes cell of a graphic column.
 */
+#define LABEL_FIELDS(X) \
+    X(material,           "MATERIAL",         "PCODE",       STORE_STRING, EMIT_MATERIAL,       LRG,              NULL,                       0) \
+    X(label,              "LABEL",            NULL,          STORE_STRING, EMIT_LABEL,          MAX_LABEL_LEN,    NULL,                       0) \
+    X(tdline,             "TDLINE",           NULL,          STORE_TEXT,   EMIT_TDLINE,         0,                NULL,                       ATTR_QUOTED) \
+    X(template,           "TEMPLATENUMBER",   "TEMPLATE",    STORE_STRING, EMIT_INFO,           MAX_TEMPLATE_LEN, NULL,                       0) \
+    X(revision,           "REVISION",         NULL,          STORE_STRING, EMIT_REVISION,       MAX_REV_LEN,      NULL,                       0) \
+    X(size,               "SIZE",             NULL,          STORE_LOOKUP, EMIT_VALUE,          MED,              NULL,                       ATTR_QUOTED) \
+    X(level,              "LEVEL",            NULL,          STORE_LOOKUP, EMIT_VALUE,          MAX_LEVEL,        NULL,                       ATTR_STANDARD) \
+    X(quantity,           "QUANTITY",         NULL,          STORE_STRING, EMIT_VALUE,          LRG,              NULL,                       0) \
+    X(barcodetext,        "BARCODETEXT",      NULL,          STORE_GTIN,   EMIT_VALUE,          MAX_GTIN_LEN,     NULL,                       0) \
+    X(gtin,               "GTIN",             NULL,          STORE_GTIN,   EMIT_VALUE,          MAX_GTIN_LEN,     NULL,                       ATTR_NON_SAP) \
+    X(ltnumber,           "LTNUMBER",         NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       0) \
+    X(ipn,                "IPN",              NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP) \
+    X(caution,            "CAUTION",          NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "Caution.tif",           0) \
+    X(consultifu,         "CONSULTIFU",       NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "ConsultIFU.tif",        0) \
+    X(latex,              "CONTAINSLATEX",    NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "Latex.tif",             0) \
+    X(donotusedamaged,    "DONOTUSEDAM",      "DONOTPAKDAM", STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "DoNotUsePakDam.tif",    0) \
+    X(latexfree,          "LATEXFREE",        NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "Latex Free.tif",        0) \
+    X(maninbox,           "MANINBOX",         NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "ManInBox.tif",          0) \
+    X(noresterilize,      "NORESTERILE",      NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "DoNotRe-sterilize.tif", 0) \
+    X(nonsterile,         "NONSTERILE",       NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "Non-sterile.tif",       0) \
+    X(pvcfree,            "PVCFREE",          NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "PVC_Free.tif",          0) \
+    X(reusable,           "REUSABLE",         NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "REUSABLE.tif",          0) \
+    X(singleuseonly,      "SINGLEUSE",        NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "Singleuse.tif",         0) \
+    X(singlepatientuse,   "SINGLEPATIENTUSE", NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "SINGLEPATIENUSE.tif",   0) \
+    X(electroifu,         "ELECTROSURIFU",    NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "ElectroSurIFU.tif",     0) \
+    X(keepdry,            "KEEPDRY",          NULL,          STORE_FLAG,   EMIT_GRAPHIC0X,      0,                F_ "KeepDry.tif",           0) \
+    X(barcode1,           "BARCODE1",         NULL,          STORE_GTIN,   EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(gs1,                "GS1",              NULL,          STORE_GTIN,   EMIT_GS1,            MED,              "GS1",                      0) \
+    X(ecrep,              "ECREP",            NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "EC Rep.tif",            0) \
+    X(expdate,            "EXPDATE",          NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "Expiration Date.tif",   0) \
+    X(keepawayheat,       "KEEPAWAYHEAT",     NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "KeepAwayHeat.tif",      0) \
+    X(lotgraphic,         "LOTGRAPHIC",       NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "Lot.tif",               0) \
+    X(manufacturer,       "MANUFACTURER",     NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "Manufacturer.tif",      0) \
+    X(mfgdate,            "MFGDATE",          NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "DateofManufacture.tif", 0) \
+    X(phtdehp,            "PHTDEHP",          NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                "PHT-DEHP.tif",             0) \
+    X(phtbbp,             "PHTBBP",           NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "PHT-BBP.tif",           0) \
+    X(phtdinp,            "PHTDINP",          NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "PHT-DINP.tif",          0) \
+    X(refnumber,          "REFNUMBER",        NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "REF.tif",               0) \
+    X(ref,                "REF",              NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "REF.tif",               0) \
+    X(rxonly,             "RXONLY",           NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "RX Only.tif",           0) \
+    X(serial,             "SERIAL",           NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "Serial Number.tif",     0) \
+    X(tfxlogo,            "TFXLOGO",          NULL,          STORE_FLAG,   EMIT_BOOLEAN,        0,                F_ "TeleflexMedical.tif",   0) \
+    X(sizelogo,           "SIZELOGO",         NULL,          STORE_FLAG,   EMIT_BOOLEAN_HEADER, 0,                NULL,                       0) \
+    X(address,            "ADDRESS",          NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(cautionstatement,   "CAUTIONSTATE",     NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(cemark,             "CE0120",           NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(coostate,           "COOSTATE",         NULL,          STORE_STRING, EMIT_GRAPHIC,        LRG,              "Nothing",                  0) \
+    X(distby,             "DISTRIBUTEDBY",    NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(ecrepaddress,       "ECREPADDRESS",     NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(flgraphic,          "FLGRAPHIC",        NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(labelgraph1,        "LABELGRAPH1",      NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(labelgraph2,        "LABELGRAPH2",      NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(latexstatement,     "LATEXSTATEMENT",   NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(logo1,              "LOGO1",            NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(logo2,              "LOGO2",            NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(logo3,              "LOGO3",            NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(logo4,              "LOGO4",            NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(logo5,              "LOGO5",            NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(mdr1,               "MDR1",             NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(mdr2,               "MDR2",             NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(mdr3,               "MDR3",             NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(mdr4,               "MDR4",             NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(mdr5,               "MDR5",             NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(manufacturedby,     "MANUFACTUREDBY",   NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(patentstatement,    "PATENTSTA",        NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(sterilitystatement, "STERILESTA",       NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(sterilitytype,      "STERILITYTYPE",    NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "blank-01.txt",             0) \
+    X(temprange,          "TEMPRANGE",        NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(version,            "VERSION",          NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "Nothing",                  0) \
+    X(insertgraphic,      "INSERTGRAPHIC",    NULL,          STORE_STRING, EMIT_GRAPHIC,        MED,              "yes",                      0) \
+    X(oldlabel,           "OLDLABEL",         NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP) \
+    X(oldtemplate,        "OLDTEMPLATE",      NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP) \
+    X(prevlabel,          "PREVLABEL",        NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP) \
+    X(prevtemplate,       "PREVTEMPLATE",     NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP) \
+    X(bomlevel,           "BOMLEVEL",         NULL,          STORE_STRING, EMIT_INFO,           SML,              NULL,                       ATTR_NON_SAP) \
+    X(description,        "DESCRIPTION",      NULL,          STORE_STRING, EMIT_INFO,           MED,              NULL,                       ATTR_NON_SAP | ATTR_QUOTED)
+
+/* the Label_record member(s) generated for each storage kind; flags
+   have no member of their own, they are bits of the label's flags word  */
+#define FIELD_MEMBER_STORE_STRING(member, size)   char member[size];
+#define FIELD_MEMBER_STORE_LOOKUP(member, size)   char member[size];
+#define FIELD_MEMBER_STORE_GTIN(member, size)     char member[size];
+#define FIELD_MEMBER_STORE_FLAG(member, size)
+#define FIELD_MEMBER_STORE_TEXT(member, size)     char *member; char **member##_segments; int member##_count;
+
+#define FIELD_MEMBER(member, column, alias, store, emit, size, graphic, attrs) \
+    FIELD_MEMBER_##store(member, size)
+
+/* a flag's "yes" bit is FLAG_YES(flag); its "no" bit is FLAG_NO(flag)    */
+#define FLAG_WORD_BITS        32
+#define FLAG_YES(flag)        ((uint64_t) 1 << (flag))
+#define FLAG_NO(flag)         ((uint64_t) 1 << ((flag) + FLAG_WORD_BITS))
+
+#define FIELD_ID(member, column, alias, store, emit, size, graphic, attrs) FIELD_##member,
+
+/* one identifier per schema entry: FIELD_material, FIELD_label, ...     */
+typedef enum {
+    LABEL_FIELDS(FIELD_ID)
+    FIELD_COUNT
+} Field_id;
+
+/* the class of a cell, in the low bits of its tag's kind               */
+#define CELL_EMPTY            0x00
+#define CELL_YES              0x01    /* "Y" or "Yes", in any case          */
+#define CELL_NO               0x02    /* "N" or "NO", in any case           */
+#define CELL_NA               0x03    /* "n/a", in any case                 */
+#define CELL_NUMERIC          0x04    /* digits only                        */
+#define CELL_TEXT             0x05    /* anything else                      */
+#define CELL_CLASS            0x0f
+
+/* what else the scan found, in the high bits                            */
+#define CELL_SPACE            0x10    /* the cell holds a space             */
+
+/** what one scan of a cell found: its class and its length              */
 typedef struct {
-    char material[LRG];
-    char coostate[LRG];
-    char address[MED];
-    char barcode1[MED];
-    char cautionstatement[MED];
-    char cemark[MED];
-    char distby[MED];
-    char ecrepaddress[MED];
-    char flgraphic[MED];
-    char gs1[MED];
-    char insertgraphic[MED];
-    char labelgraph1[MED];
-    char labelgraph2[MED];
-    char latexstatement[MED];
-    char logo1[MED];
-    char logo2[MED];
-    char logo3[MED];
-    char logo4[MED];
-    char logo5[MED];
-    char mdr1[MED];
-    char mdr2[MED];
-    char mdr3[MED];
-    char mdr4[MED];
-    char mdr5[MED];
-    char manufacturedby[MED];
-    char patentstatement[MED];
-    char size[MED];
-    char sterilitystatement[MED];
-    char sterilitytype[MED];
-    char temprange[MED];
-    char version[MED];
-    char oldlabel[MED];
-    char oldtemplate[MED];
-    char prevlabel[MED];
-    char prevtemplate[MED];
-    char description[MED];
-    char pcode[MED];
-    char ltnumber[MED];
-    char ipn[MED];
-    char barcodetext[MAX_GTIN_LEN];
-    char gtin[MAX_GTIN_LEN];
-    char level[MAX_LEVEL];
-    char label[MAX_LABEL_LEN];
-
-    char quantity[LRG];
-    char template[MAX_TEMPLATE_LEN];
-    char bomlevel[SML];
-    char revision[MAX_REV_LEN];
-    char *tdline;
-
-    unsigned int caution : 2;
-    unsigned int consultifu : 2;
-    unsigned int donotusedamaged : 2;
-    unsigned int electroifu : 2;
-    unsigned int keepdry : 2;
-    unsigned int latex : 2;
-    unsigned int latexfree : 2;
-    unsigned int maninbox : 2;
-    unsigned int nonsterile : 2;
-    unsigned int noresterilize : 2;
-    unsigned int pvcfree : 2;
-    unsigned int reusable : 2;
-    unsigned int singlepatientuse : 2;
-    unsigned int singleuseonly : 2;
-    unsigned int ecrep : 2;
-    unsigned int expdate : 2;
-    unsigned int keepawayheat : 2;
-    unsigned int lotgraphic : 2;
-    unsigned int manufacturer : 2;
-    unsigned int mfgdate : 2;
-    unsigned int phtbbp : 2;
-    unsigned int phtdehp : 2;
-    unsigned int phtdinp : 2;
-    unsigned int ref : 2;
-    unsigned int refnumber : 2;
-    unsigned int rxonly : 2;
-    unsigned int serial : 2;
-    unsigned int sizelogo : 2;
-    unsigned int tfxlogo : 2;
+    unsigned char kind;
+    unsigned char length;
+} Cell_tag;
 
+/**
+    one spreadsheet row, with a member for every LABEL_FIELDS entry. The
+    TDLINE text is kept split on "##" (tdline, tdline_segments and
+    tdline_count); each segment keeps its "##" terminator. All Y / N
+    columns are packed into flags: the low half holds a bit per flag set
+    to yes, the high half a bit per flag set to no. Each string, lookup
+    and GTIN field has a tag in tags, by field id, classifying its text.
+*/
+typedef struct {
+    LABEL_FIELDS(FIELD_MEMBER)
+    uint64_t flags;
+    Cell_tag tags[FIELD_COUNT];
 } Label_record;
 
+#define FLAG_ID_STORE_STRING(member)
+#define FLAG_ID_STORE_LOOKUP(member)
+#define FLAG_ID_STORE_GTIN(member)
+#define FLAG_ID_STORE_FLAG(member)                FLAG_##member,
+#define FLAG_ID_STORE_TEXT(member)
+
+#define FLAG_ID(member, column, alias, store, emit, size, graphic, attrs) \
+    FLAG_ID_##store(member)
+
+/* one bit number per flag, in schema order: FLAG_caution, ...           */
+typedef enum {
+    LABEL_FIELDS(FLAG_ID)
+    FLAG_COUNT
+} Flag_id;
+
+/* every flag needs a bit in each half of the flags word                 */
+typedef char flag_word_check[(FLAG_COUNT <= FLAG_WORD_BITS) ? 1 : -1];
+
+/** a schema entry, as generated from LABEL_FIELDS                       */
+typedef struct {
+    const char *column;
+    const char *alias;
+    Store_kind store;
+    Emit_kind emit;
+    size_t offset;
+    size_t size;
+    int flag;
+    const char *graphic;
+    unsigned int attrs;
+} Field_def;
+
+/** the schema table, in IDoc emission order                             */
+extern const Field_def label_fields[FIELD_COUNT];
+
+/* the fields some IDoc variant of the run prints, by field id; the
+   columns of the others are skipped as the rows are parsed              */
+extern bool wanted_fields[FIELD_COUNT];
+
+/**
+    returns the text of a string, lookup or GTIN field of a label
+*/
+static inline char *field_text(const Label_record *label, const Field_def *field) {
+    return (char *) label + field->offset;
+}
+
+/**
+    returns the tag of a string, lookup or GTIN field of a label
+*/
+static inline Cell_tag field_tag(const Label_record *label, const Field_def *field) {
+    return label->tags[field - label_fields];
+}
+
+/**
+    returns the class (CELL_EMPTY ... CELL_TEXT) of a tagged cell
+*/
+static inline unsigned int cell_class(Cell_tag tag) {
+    return tag.kind & CELL_CLASS;
+}
+
+/**
+    returns the value (0, 1 = no, 2 = yes) of a flag field of a label
+*/
+static inline unsigned int field_flag(const Label_record *label, const Field_def *field) {
+    if (label->flags & FLAG_YES(field->flag))
+        return 2;
+    return (label->flags & FLAG_NO(field->flag)) ? 1 : 0;
+}
+
+/**
+    finds the schema entry for a spreadsheet column heading or its alias
+    @param column is the column heading
+    @return the field, or NULL if the column is not part of the schema
+*/
+const Field_def *find_field(const char *column);
+
 int duplicate_column_names(const char *column_names);
 
 /**
-    identifies the column headings in a line and assigns true values to the
-    elements in the Column_header struct that correspond to those elements.
+    identifies the column headings in a line and maps each one to its schema
+    field, then copies every row's cells into the label records, walking
+    each row once.
     @param buffer is a pointer to the column headings line
-    @param cols is a pointer to a Column_header struct
-    @return the number of column headings identified
+    @param labels is the array of label records to fill
+    @return the number of column headings identified, or -1 on error
 */
 int parse_spreadsheet(char *buffer, Label_record *labels);
 
+/**
+    identifies the column headings in a line and maps each one to its schema
+    field
+    @param buffer is a pointer to the column headings line, which is consumed
+    @param plan receives the schema field of each column, or NULL for an
+           ignored column; the caller frees it
+    @return the number of column headings identified, or -1 on error
+*/
+int plan_columns(char *buffer, const Field_def ***plan);
+
+/**
+    copies the cells of a block of rows into label records, as a column plan
+    maps them. Row i fills labels[i]; row 0 is the column headings line.
+    @param plan is the schema field of each column
+    @param count is the number of columns in the plan
+    @param rows is the rows
+    @param row_count is the number of rows, the column headings line included
+    @param labels is the array of label records to fill
+    @return 0 if successful, -1 if unsuccessful
+*/
+int parse_rows(const Field_def **plan, int count, char **rows, int row_count, Label_record *labels);
+
 /**
     get_token dynamically allocates a text substring and copies the substring
     of buffer that occurs before the next occurrence of the delimiter,
@@ -155,30 +364,59 @@ int parse_spreadsheet(char *buffer, Label_record *labels);
 char *get_token(char *buffer, char tab_str);
 
 /**
- * Given a specific delimiter, extracts the value of that field with a delimited char string.
- * Returns the length of that value if it exists and isn't "N" or "NO"
- * @param contents
- * @param i
- * @param count
- * @param tab_str
- * @return
- */
-int get_field_contents_from_row(char *contents, int i, int count, char tab_str);
+    decodes a quoted spreadsheet cell in place, in a single pass: a leading
+    and a trailing quote are removed and every doubled quote ("") inside the
+    cell becomes a single quote.
+    @param field is the cell contents to decode
+    @return the length of the decoded field
+*/
+size_t unquote_field(char *field);
 
-int peek_nth_token(int n, const char *buffer, char delimiter);
+/**
+    splits decoded TDLINE text into the label's segment list. The text is
+    broken after every "##", which stays at the end of its segment, so the
+    emitter only has to copy each prepared segment into its record.
+    @param label is the label record that receives the segments
+    @param text is the decoded TDLINE text
+    @return the number of segments, or -1 if memory could not be allocated
+*/
+int split_tdline(Label_record *label, const char *text);
 
 int strncmpci(const char *str1, const char *str2, int num);
 
-int equals_yes(char *field);
+int equals_yes(const char *field);
 
-int equals_no(char *field);
+int equals_no(const char *field);
+
+/**
+    classifies a cell in one scan: whether it is empty, "Y" / "Yes",
+    "N" / "NO", "n/a", numeric or other text, whether it holds a space,
+    and its length
+    @param text is the cell
+    @return the cell's tag; a length past 255 is kept as 255
+*/
+Cell_tag classify_cell(const char *text);
 
 int spreadsheet_init();
 
 int spreadsheet_expand();
 
+/**
+    stores a row as the next spreadsheet row, growing the spreadsheet array
+    as needed
+    @param buffer holds the row's characters (not null-terminated)
+    @param length is the number of characters in the row
+*/
+void add_spreadsheet_row(const char *buffer, size_t length);
+
 int sort_labels(Label_record *labels);
 
+/**
+    sorts the label records labels[first] to labels[end - 1] by label number
+    @return true if they were already sorted
+*/
+int sort_label_range(Label_record *labels, int first, int end);
+
 void swap_label_records(Label_record *labels, int i, int min_index);
 
 #endif
\ No newline at end of file
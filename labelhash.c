@@ -0,0 +1,168 @@
+/**
+ *  labelhash.c
+ */
+#include "labelhash.h"
+#include "strl.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* the 64-bit FNV-1a prime                                               */
+#define FNV_PRIME        1099511628211ULL
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t n) {
+
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < n; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t fnv1a_string(const char *s) {
+    return fnv1a(FNV_OFFSET_BASIS, s, strlen(s));
+}
+
+size_t hash_table_cap(size_t expected) {
+
+    size_t cap = 16;
+    while (cap < 2 * (expected > 0 ? expected : 1))
+        cap *= 2;
+    return cap;
+}
+
+void *hash_table_slot(const Hash_ops *ops, void *entries, size_t cap, uint64_t hash, const void *key) {
+
+    char *base = (char *) entries;
+    size_t slot = (size_t) hash & (cap - 1);
+
+    // a NULL key matches nothing, which finds the empty slot a moved entry goes in
+    while (ops->used(base + slot * ops->size) && (key == NULL || !ops->matches(base + slot * ops->size, key)))
+        slot = (slot + 1) & (cap - 1);
+    return base + slot * ops->size;
+}
+
+void *hash_table_reserve(const Hash_ops *ops, void *entries, size_t *cap, size_t count) {
+
+    if (2 * (count + 1) <= *cap)
+        return entries;
+
+    char *grown = (char *) calloc(2 * *cap, ops->size);
+    if (grown == NULL)
+        return NULL;
+    for (size_t e = 0; e < *cap; e++) {
+        const char *entry = (const char *) entries + e * ops->size;
+        if (ops->used(entry))
+            memcpy(hash_table_slot(ops, grown, 2 * *cap, ops->hash(entry), NULL), entry, ops->size);
+    }
+    free(entries);
+    *cap *= 2;
+    return grown;
+}
+
+uint64_t label_record_hash(const Label_record *label) {
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        const Field_def *field = &label_fields[f];
+
+        // each value keeps its terminator, so "ab" + "c" differs from "a" + "bc"
+        if (field->store == STORE_TEXT) {
+            for (int seg = 0; seg < label->tdline_count; seg++)
+                hash = fnv1a(hash, label->tdline_segments[seg], strlen(label->tdline_segments[seg]) + 1);
+            hash = fnv1a(hash, "", 1);
+        } else if (field->store != STORE_FLAG) {
+            const char *value = field_text(label, field);
+            hash = fnv1a(hash, value, strlen(value) + 1);
+        }
+    }
+    return fnv1a(hash, &label->flags, sizeof(label->flags));
+}
+
+/**
+    returns true if two label records have the same TDLINE segments
+*/
+static bool same_tdline(const Label_record *a, const Label_record *b) {
+
+    if (a->tdline_count != b->tdline_count)
+        return false;
+    for (int seg = 0; seg < a->tdline_count; seg++)
+        if (strcmp(a->tdline_segments[seg], b->tdline_segments[seg]) != 0)
+            return false;
+    return true;
+}
+
+int label_record_diff(const Label_record *a, const Label_record *b, const Field_def **diffs) {
+
+    int count = 0;
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        const Field_def *field = &label_fields[f];
+        bool same;
+
+        if (field->store == STORE_TEXT)
+            same = same_tdline(a, b);
+        else if (field->store == STORE_FLAG)
+            same = ((a->flags ^ b->flags) & (FLAG_YES(field->flag) | FLAG_NO(field->flag))) == 0;
+        else
+            same = strcmp(field_text(a, field), field_text(b, field)) == 0;
+
+        if (!same)
+            diffs[count++] = field;
+    }
+    return count;
+}
+
+static bool label_used(const void *entry) {
+    return ((const Label_entry *) entry)->used;
+}
+
+static bool label_matches(const void *entry, const void *key) {
+    return strcmp(((const Label_entry *) entry)->label, (const char *) key) == 0;
+}
+
+static uint64_t label_hash(const void *entry) {
+    return fnv1a_string(((const Label_entry *) entry)->label);
+}
+
+static const Hash_ops label_ops = {sizeof(Label_entry), label_used, label_matches, label_hash};
+
+int label_table_init(Label_table *table, int expected) {
+
+    table->cap = hash_table_cap(expected > 0 ? (size_t) expected : 1);
+    table->count = 0;
+    table->entries = (Label_entry *) calloc(table->cap, sizeof(Label_entry));
+    return table->entries == NULL ? -1 : 0;
+}
+
+/**
+    returns the slot of a label: its entry, or the empty slot it belongs in
+*/
+static Label_entry *find_slot(const Label_table *table, const char *label) {
+    return (Label_entry *) hash_table_slot(&label_ops, table->entries, table->cap, fnv1a_string(label), label);
+}
+
+Label_entry *label_table_insert(Label_table *table, const char *label, bool *found) {
+
+    Label_entry *entry = find_slot(table, label);
+
+    *found = entry->used;
+    if (!entry->used) {
+        entry->used = true;
+        strlcpy(entry->label, label, sizeof(entry->label));
+        table->count++;
+    }
+    return entry;
+}
+
+Label_entry *label_table_find(const Label_table *table, const char *label) {
+
+    Label_entry *entry = find_slot(table, label);
+    return entry->used ? entry : NULL;
+}
+
+void label_table_free(Label_table *table) {
+    free(table->entries);
+    table->entries = NULL;
+}
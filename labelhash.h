@@ -0,0 +1,141 @@
+/**
+    @file labelhash.h
+    Together with labelhash.c, this component hashes parsed label records
+    and keeps them in a hash table keyed by label number, so label rows can
+    be matched up with one table lookup each: the rows of two versions of
+    a spreadsheet, or the repeated rows of one. Its FNV-1a hash and its
+    open-addressing probe and grow are shared by the other hash tables: the
+    GTIN cache, the record cache and the graphics set.
+*/
+
+#ifndef STOIDOC_LABELHASH_H
+#define STOIDOC_LABELHASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "label.h"
+
+/* the 64-bit FNV-1a hash of no bytes                                    */
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+/**
+    how an open-addressing table's entries are told apart. Every table is
+    an array of cap entries, cap a power of two, probed linearly and kept
+    at most half full.
+*/
+typedef struct {
+    size_t size;
+    bool (*used)(const void *entry);
+    bool (*matches)(const void *entry, const void *key);
+    uint64_t (*hash)(const void *entry);
+} Hash_ops;
+
+/** a label in the table, with the hash of its record's contents         */
+typedef struct {
+    char label[MAX_LABEL_LEN];
+    char material[LRG];
+    uint64_t hash;
+    int row;
+    bool used;
+    bool seen;
+    bool conflicting;
+} Label_entry;
+
+/** an open-addressing hash table of labels                              */
+typedef struct {
+    Label_entry *entries;
+    size_t cap;
+    size_t count;
+} Label_table;
+
+/**
+    adds n bytes to a running FNV-1a hash
+    @param hash is the hash so far, FNV_OFFSET_BASIS to start
+    @param data is the bytes
+    @param n is the number of bytes
+    @return the hash with the bytes added
+*/
+uint64_t fnv1a(uint64_t hash, const void *data, size_t n);
+
+/**
+    hashes a string, without its terminator
+    @return the 64-bit FNV-1a hash of the string
+*/
+uint64_t fnv1a_string(const char *s);
+
+/**
+    returns the number of slots a table needs to hold a number of entries
+    at most half full
+*/
+size_t hash_table_cap(size_t expected);
+
+/**
+    finds the slot of a key: its entry, or the empty slot it belongs in
+    @param ops describes the entries
+    @param entries is the table's array
+    @param cap is the number of slots, a power of two
+    @param hash is the key's hash
+    @param key is the key, which ops->matches compares with entries
+    @return the slot
+*/
+void *hash_table_slot(const Hash_ops *ops, void *entries, size_t cap, uint64_t hash, const void *key);
+
+/**
+    makes room in a table for another entry, doubling it and moving its
+    entries if it would be more than half full
+    @param ops describes the entries
+    @param entries is the table's array
+    @param cap is the number of slots, updated
+    @param count is the number of entries in the table
+    @return the table's array, which is a new one if it grew, or NULL if out
+    of memory, in which case the table is unchanged
+*/
+void *hash_table_reserve(const Hash_ops *ops, void *entries, size_t *cap, size_t count);
+
+/**
+    hashes the contents of a label record: every field of the schema,
+    TDLINE segments and flags included
+    @param label is the label record
+    @return the 64-bit FNV-1a hash of the record's contents
+*/
+uint64_t label_record_hash(const Label_record *label);
+
+/**
+    compares two label records field by field
+    @param a is one label record
+    @param b is the other
+    @param diffs receives the schema entry of each field that differs, and
+           must have room for FIELD_COUNT entries
+    @return the number of fields that differ
+*/
+int label_record_diff(const Label_record *a, const Label_record *b, const Field_def **diffs);
+
+/**
+    creates an empty table sized for a number of labels
+    @param table is the table to initialize
+    @param expected is the number of labels expected
+    @return 0 if successful, -1 if unsuccessful
+*/
+int label_table_init(Label_table *table, int expected);
+
+/**
+    finds a label in the table, adding it if it is not there. A new entry
+    has only its label set.
+    @param table is the table, which must have room for another label
+    @param label is the label number
+    @param found receives true if the label was already in the table
+    @return the label's entry
+*/
+Label_entry *label_table_insert(Label_table *table, const char *label, bool *found);
+
+/**
+    finds a label in the table
+    @return the label's entry, or NULL if the label is not in the table
+*/
+Label_entry *label_table_find(const Label_table *table, const char *label);
+
+void label_table_free(Label_table *table);
+
+#endif //STOIDOC_LABELHASH_H
@@ -0,0 +1,101 @@
+/**
+ *  reccache.c
+ */
+#include "reccache.h"
+#include "labelhash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** a record's key: its schema field, graphics path and cell value        */
+typedef struct {
+    int field;
+    bool alt_path;
+    const char *value;
+} Record_key;
+
+static uint64_t hash_key(int field, bool alt_path, const char *value) {
+
+    uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &field, sizeof(field));
+    hash = fnv1a(hash, &alt_path, sizeof(alt_path));
+    return fnv1a(hash, value, strlen(value));
+}
+
+static bool record_used(const void *entry) {
+    return ((const Record_entry *) entry)->used;
+}
+
+static bool record_matches(const void *entry, const void *key) {
+
+    const Record_entry *e = (const Record_entry *) entry;
+    const Record_key *k = (const Record_key *) key;
+    return e->field == k->field && e->alt_path == k->alt_path && strcmp(e->value, k->value) == 0;
+}
+
+static uint64_t record_hash(const void *entry) {
+
+    const Record_entry *e = (const Record_entry *) entry;
+    return hash_key(e->field, e->alt_path, e->value);
+}
+
+static const Hash_ops record_ops = {sizeof(Record_entry), record_used, record_matches, record_hash};
+
+/**
+    returns the slot of a key: its entry, or the empty slot it belongs in
+*/
+static Record_entry *find_slot(const Record_cache *cache, int field, bool alt_path, const char *value) {
+
+    Record_key key = {field, alt_path, value};
+    return (Record_entry *) hash_table_slot(&record_ops, cache->entries, cache->cap,
+                                            hash_key(field, alt_path, value), &key);
+}
+
+static int init_table(Record_cache *cache, size_t cap) {
+
+    cache->cap = cap;
+    cache->count = 0;
+    cache->entries = (Record_entry *) calloc(cap, sizeof(Record_entry));
+    return cache->entries == NULL ? -1 : 0;
+}
+
+int record_cache_init(Record_cache *cache) {
+    return init_table(cache, 256);
+}
+
+Record_entry *record_cache_insert(Record_cache *cache, int field, bool alt_path, const char *value, bool *found) {
+
+    Record_entry *entries = (Record_entry *) hash_table_reserve(&record_ops, cache->entries, &cache->cap, cache->count);
+    if (entries == NULL)
+        return NULL;
+    cache->entries = entries;
+
+    Record_entry *entry = find_slot(cache, field, alt_path, value);
+    *found = entry->used;
+    if (!entry->used) {
+        strcpy(entry->value, value);
+        entry->field = field;
+        entry->alt_path = alt_path;
+        entry->used = true;
+        cache->count++;
+    }
+    return entry;
+}
+
+const Record_entry *record_cache_find(const Record_cache *cache, int field, bool alt_path, const char *value) {
+
+    if (cache->entries == NULL || strlen(value) >= MED)
+        return NULL;
+
+    const Record_entry *entry = find_slot(cache, field, alt_path, value);
+    return (entry->used && entry->body != NULL) ? entry : NULL;
+}
+
+void record_cache_free(Record_cache *cache) {
+
+    for (size_t e = 0; cache->entries != NULL && e < cache->cap; e++)
+        free(cache->entries[e].body);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->cap = 0;
+    cache->count = 0;
+}
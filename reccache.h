@@ -0,0 +1,57 @@
+/**
+    @file reccache.h
+    Together with reccache.c, this component keeps the rendered text of
+    characteristic records in a hash table keyed by schema field, graphics
+    path and cell value. Every label that names the same graphic in the
+    same column gets the same record but for its sequence numbers, so the
+    text after the record prefix is rendered once and copied from then on.
+*/
+
+#ifndef STOIDOC_RECCACHE_H
+#define STOIDOC_RECCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "label.h"
+
+/** a record's text after its prefix, line feed included                 */
+typedef struct {
+    char value[MED];
+    int field;
+    bool alt_path;
+    bool used;
+    char *body;
+    size_t length;
+} Record_entry;
+
+/** an open-addressing hash table of rendered records                    */
+typedef struct {
+    Record_entry *entries;
+    size_t cap;
+    size_t count;
+} Record_cache;
+
+int record_cache_init(Record_cache *cache);
+
+/**
+    finds a record in the cache, adding it if it is not there. A new entry
+    has no body, which the caller renders.
+    @param cache is the cache
+    @param field is the index of the record's schema field
+    @param alt_path is true if the record names the alternate graphics path
+    @param value is the cell value, which must be shorter than MED
+    @param found receives true if the record was already in the cache
+    @return the record's entry, or NULL if out of memory
+*/
+Record_entry *record_cache_insert(Record_cache *cache, int field, bool alt_path, const char *value, bool *found);
+
+/**
+    finds a record in the cache
+    @return the record's entry, or NULL if it is not in the cache
+*/
+const Record_entry *record_cache_find(const Record_cache *cache, int field, bool alt_path, const char *value);
+
+void record_cache_free(Record_cache *cache);
+
+#endif //STOIDOC_RECCACHE_H
@@ -0,0 +1,395 @@
+/**
+ *  rowindex.c
+ */
+#include "rowindex.h"
+#include "label.h"
+#include "strl.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the first line of a row index names its version; the spreadsheet's size
+   and modification time follow it                                        */
+#define ROW_INDEX_MAGIC       "stoidoc-rows 1"
+
+/* the longest line of a row index                                       */
+#define ROW_INDEX_LINE_LEN    (2 * 24 + MAX_LABEL_LEN + LRG + 4)
+
+/** a spreadsheet row's place in the file, and its label and material    */
+typedef struct {
+    long offset;
+    long length;
+    char label[MAX_LABEL_LEN];
+    char material[LRG];
+} Row_entry;
+
+/** the columns holding the row keys, or -1 if the header has none        */
+typedef struct {
+    int label;
+    int material;
+} Key_columns;
+
+int add_filter_values(const char *list, char ***values, int *count) {
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+
+        if (len > 0) {
+            char **temp = (char **) realloc(*values, (*count + 1) * sizeof(char *));
+            if (temp == NULL)
+                return -1;
+            *values = temp;
+            if (((*values)[*count] = strndup(list, len)) == NULL)
+                return -1;
+            (*count)++;
+        }
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+    return 0;
+}
+
+bool row_filter_active(const Row_filter *filter) {
+    return (filter->label_count > 0) || (filter->first_label != NULL) || (filter->material_count > 0);
+}
+
+void free_row_filter(Row_filter *filter) {
+
+    for (int i = 0; i < filter->label_count; i++)
+        free(filter->labels[i]);
+    for (int i = 0; i < filter->material_count; i++)
+        free(filter->materials[i]);
+    free(filter->labels);
+    free(filter->materials);
+}
+
+/**
+    returns true if value is one of the count values
+*/
+static bool contains(char **values, int count, const char *value) {
+
+    for (int i = 0; i < count; i++)
+        if (strcmp(values[i], value) == 0)
+            return true;
+    return false;
+}
+
+bool row_matches(const Row_filter *filter, const char *label, const char *material) {
+
+    if ((filter->label_count > 0) && !contains(filter->labels, filter->label_count, label))
+        return false;
+    if ((filter->first_label != NULL) &&
+        ((strcmp(label, filter->first_label) < 0) || (strcmp(label, filter->last_label) > 0)))
+        return false;
+    if ((filter->material_count > 0) && !contains(filter->materials, filter->material_count, material))
+        return false;
+    return true;
+}
+
+/**
+    copies a row's nth cell the way parse_spreadsheet() stores it: without
+    any ".tif" extension and cut to the size of its field
+    @param row is the spreadsheet row
+    @param col is the cell's column, or -1 for a blank cell
+    @param dst receives the cell
+    @param size is the size of dst
+*/
+static void copy_cell(const char *row, int col, char *dst, size_t size) {
+
+    const char *cell = row;
+    size_t length;
+
+    dst[0] = '\0';
+    if (col < 0)
+        return;
+    for (int c = 0; c < col; c++) {
+        if ((cell = strchr(cell, TAB)) == NULL)
+            return;
+        cell++;
+    }
+
+    length = strcspn(cell, "\t");
+    if ((length > 4) && (strncmp(cell + length - 4, ".tif", 4) == 0))
+        length -= 4;
+    if (length >= size)
+        length = size - 1;
+    memcpy(dst, cell, length);
+    dst[length] = '\0';
+}
+
+/**
+    finds the LABEL and MATERIAL columns of a spreadsheet header, by their
+    names or aliases
+*/
+static Key_columns find_key_columns(const char *header) {
+
+    Key_columns cols = {-1, -1};
+    char name[LRG];
+
+    for (int col = 0; *header; col++) {
+        size_t length = strcspn(header, "\t");
+        const Field_def *field;
+
+        snprintf(name, sizeof(name), "%.*s", (int) length, header);
+        if ((field = find_field(name)) == &label_fields[FIELD_label])
+            cols.label = col;
+        else if (field == &label_fields[FIELD_material])
+            cols.material = col;
+
+        header += length;
+        if (*header == TAB)
+            header++;
+    }
+    return cols;
+}
+
+/**
+    reads a spreadsheet, row by row as read_spreadsheet() does, and records
+    each row's place in the file and its label and material. The header is
+    the first entry.
+    @param fp points to the spreadsheet
+    @param count receives the number of rows, header included
+    @return the array of rows, or NULL if unsuccessful
+*/
+static Row_entry *build_row_index(FILE *fp, int *count) {
+
+    size_t buffer_cap = INITIAL_ROW_WIDTH;
+    char *buffer = (char *) malloc(buffer_cap);
+    Row_entry *entries = NULL;
+    Key_columns cols = {-1, -1};
+    bool line_not_empty = false;
+    long offset = 0, start = 0;
+    size_t i = 0;
+    int c;
+
+    *count = 0;
+    if (buffer == NULL)
+        return NULL;
+
+    for (;; offset++) {
+        c = getc(fp);
+
+        // a row ends at a line feed not preceded by "##", and at the end of the file
+        if ((c == EOF) || ((c == '\n') && ((i < 2) || buffer[i - 1] != '#' || buffer[i - 2] != '#'))) {
+            if (line_not_empty) {
+                Row_entry *temp = (Row_entry *) realloc(entries, (*count + 1) * sizeof(Row_entry));
+                if (temp == NULL)
+                    break;
+                entries = temp;
+
+                buffer[i] = '\0';
+                Row_entry *entry = &entries[(*count)++];
+                entry->offset = start;
+                entry->length = offset - start;
+                if (*count == 1) {
+                    cols = find_key_columns(buffer);
+                    entry->label[0] = entry->material[0] = '\0';
+                } else {
+                    copy_cell(buffer, cols.label, entry->label, sizeof(entry->label));
+                    copy_cell(buffer, cols.material, entry->material, sizeof(entry->material));
+                }
+            }
+            if (c == EOF) {
+                free(buffer);
+                return entries;
+            }
+            i = 0;
+            line_not_empty = false;
+            start = offset + 1;
+
+        } else if (c != '\n') {
+            if (i + 1 >= buffer_cap) {
+                char *temp = (char *) realloc(buffer, buffer_cap *= 2);
+                if (temp == NULL)
+                    break;
+                buffer = temp;
+            }
+            buffer[i++] = (char) c;
+            if (c != '\t' && c != '\r')
+                line_not_empty = true;
+        }
+    }
+
+    free(buffer);
+    free(entries);
+    return NULL;
+}
+
+/**
+    writes a row index, first to a temporary file that is then renamed, so
+    that a concurrent conversion never reads half of one
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int save_row_index(const char *name, const struct stat *st, const Row_entry *entries, int count) {
+
+    char *tmp = (char *) malloc(strlen(name) + 5);
+    FILE *fp;
+    int rc = 0;
+
+    if (tmp == NULL)
+        return -1;
+    sprintf(tmp, "%s.tmp", name);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        free(tmp);
+        return -1;
+    }
+
+    fprintf(fp, "%s %lld %lld %ld\n", ROW_INDEX_MAGIC, (long long) st->st_size,
+            (long long) st->st_mtim.tv_sec, (long) st->st_mtim.tv_nsec);
+    for (int r = 0; r < count; r++)
+        fprintf(fp, "%ld\t%ld\t%s\t%s\n", entries[r].offset, entries[r].length,
+                entries[r].label, entries[r].material);
+
+    if ((fclose(fp) != 0) || (rename(tmp, name) != 0)) {
+        remove(tmp);
+        rc = -1;
+    }
+    free(tmp);
+    return rc;
+}
+
+/**
+    reads a row index, unless it was built for another version of the
+    spreadsheet
+    @param name is the row index file
+    @param st is the spreadsheet's current status
+    @param count receives the number of rows, header included
+    @return the array of rows, or NULL if the row index is missing, out of
+    date or unreadable
+*/
+static Row_entry *load_row_index(const char *name, const struct stat *st, int *count) {
+
+    char line[ROW_INDEX_LINE_LEN];
+    char expected[ROW_INDEX_LINE_LEN];
+    Row_entry *entries = NULL;
+    FILE *fp;
+
+    *count = 0;
+    if ((fp = fopen(name, "r")) == NULL)
+        return NULL;
+
+    snprintf(expected, sizeof(expected), "%s %lld %lld %ld\n", ROW_INDEX_MAGIC, (long long) st->st_size,
+             (long long) st->st_mtim.tv_sec, (long) st->st_mtim.tv_nsec);
+    if ((fgets(line, sizeof(line), fp) == NULL) || (strcmp(line, expected) != 0)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        Row_entry entry;
+        char *label, *material;
+
+        line[strcspn(line, "\n")] = '\0';
+        if ((sscanf(line, "%ld\t%ld", &entry.offset, &entry.length) != 2) ||
+            ((label = strchr(line, TAB)) == NULL) || ((label = strchr(label + 1, TAB)) == NULL) ||
+            ((material = strchr(++label, TAB)) == NULL))
+            break;
+        *material++ = '\0';
+        strlcpy(entry.label, label, sizeof(entry.label));
+        strlcpy(entry.material, material, sizeof(entry.material));
+
+        Row_entry *temp = (Row_entry *) realloc(entries, (*count + 1) * sizeof(Row_entry));
+        if (temp == NULL)
+            break;
+        entries = temp;
+        entries[(*count)++] = entry;
+    }
+
+    // a row index that is cut short is as good as missing
+    if (!feof(fp) || *count == 0) {
+        free(entries);
+        entries = NULL;
+    }
+    fclose(fp);
+    return entries;
+}
+
+int read_filtered_spreadsheet(const char *filename, const Row_filter *filter) {
+
+    char *name = (char *) malloc(strlen(filename) + strlen(ROW_INDEX_EXT) + 1);
+    Row_entry *entries;
+    struct stat st;
+    int count = 0;
+    int fd;
+
+    if (name == NULL)
+        return -1;
+    sprintf(name, "%s%s", filename, ROW_INDEX_EXT);
+
+    if (((fd = open(filename, O_RDONLY)) < 0) || (fstat(fd, &st) != 0)) {
+        free(name);
+        return -1;
+    }
+
+    if ((entries = load_row_index(name, &st, &count)) == NULL) {
+        FILE *fp = fdopen(dup(fd), "r");
+
+        printf("Indexing the rows of \"%s\"\n", filename);
+        if (fp != NULL) {
+            entries = build_row_index(fp, &count);
+            fclose(fp);
+        }
+        if (entries != NULL && save_row_index(name, &st, entries, count) != 0)
+            printf("Could not write row index %s\n", name);
+    }
+    free(name);
+
+    if (entries == NULL || count == 0) {
+        free(entries);
+        close(fd);
+        return -1;
+    }
+
+    // the header and the matching rows are read, with each row's "##" line feeds dropped
+    char *buffer = NULL;
+    int rc = 0;
+    for (int r = 0; r < count && rc == 0; r++) {
+        if ((r > 0) && !row_matches(filter, entries[r].label, entries[r].material))
+            continue;
+
+        char *temp = (char *) realloc(buffer, (size_t) entries[r].length + 1);
+        if ((temp == NULL) ||
+            (pread(fd, temp, (size_t) entries[r].length, (off_t) entries[r].offset) != entries[r].length)) {
+            buffer = temp ? temp : buffer;
+            rc = -1;
+            break;
+        }
+        buffer = temp;
+
+        size_t length = 0;
+        for (long i = 0; i < entries[r].length; i++)
+            if (buffer[i] != '\n')
+                buffer[length++] = buffer[i];
+        add_spreadsheet_row(buffer, length);
+    }
+
+    free(buffer);
+    free(entries);
+    close(fd);
+    return rc;
+}
+
+void filter_spreadsheet_rows(const Row_filter *filter) {
+
+    Key_columns cols;
+    char label[MAX_LABEL_LEN];
+    char material[LRG];
+    int kept = 1;
+
+    if (spreadsheet_row_number == 0)
+        return;
+    cols = find_key_columns(spreadsheet[0]);
+
+    for (int i = 1; i < spreadsheet_row_number; i++) {
+        copy_cell(spreadsheet[i], cols.label, label, sizeof(label));
+        copy_cell(spreadsheet[i], cols.material, material, sizeof(material));
+        if (row_matches(filter, label, material))
+            spreadsheet[kept++] = spreadsheet[i];
+        else
+            free(spreadsheet[i]);
+    }
+    spreadsheet_row_number = kept;
+}
@@ -0,0 +1,78 @@
+/**
+    @file rowindex.h
+    Together with rowindex.c, this component loads just the spreadsheet
+    rows a conversion asks for: those of given labels, of a range of labels
+    or of given materials. An uncompressed spreadsheet gets a row index
+    beside it, "<spreadsheet>.rows", that maps each row's LABEL and MATERIAL
+    to the row's byte offset and length. It is rebuilt whenever the
+    spreadsheet's size or modification time changes, so later conversions
+    of the same spreadsheet read only the header and the matching rows. A
+    compressed spreadsheet is read whole and its other rows dropped.
+*/
+
+#ifndef STOIDOC_ROWINDEX_H
+#define STOIDOC_ROWINDEX_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* extension of the row index written beside the spreadsheet             */
+#define ROW_INDEX_EXT         ".rows"
+
+/**
+    the rows to convert. A row is converted if it passes every filter that
+    is set: its label is one of labels, its label is in the range
+    first_label - last_label, and its material is one of materials.
+*/
+typedef struct {
+    char **labels;
+    int label_count;
+    const char *first_label;
+    const char *last_label;
+    char **materials;
+    int material_count;
+} Row_filter;
+
+/**
+    adds the comma-separated values of a list to a filter's labels or
+    materials
+    @param list is the list, e.g. "LBL0001,LBL0002"
+    @param values is the filter's array of values, updated
+    @param count is the number of values in the array, updated
+    @return 0 if successful, -1 if unsuccessful
+*/
+int add_filter_values(const char *list, char ***values, int *count);
+
+/**
+    returns true if any filter is set
+*/
+bool row_filter_active(const Row_filter *filter);
+
+/**
+    returns true if a row with the given label and material passes the filter
+*/
+bool row_matches(const Row_filter *filter, const char *label, const char *material);
+
+/**
+    reads the header and the rows that pass the filter into the spreadsheet
+    array, through the spreadsheet's row index, which is built first if it
+    is missing or out of date
+    @param filename is the spreadsheet, which must be uncompressed
+    @param filter is the filter to apply
+    @return 0 if successful, -1 if unsuccessful
+*/
+int read_filtered_spreadsheet(const char *filename, const Row_filter *filter);
+
+/**
+    drops the rows that do not pass the filter from a spreadsheet that has
+    been read whole
+    @param filter is the filter to apply
+*/
+void filter_spreadsheet_rows(const Row_filter *filter);
+
+/**
+    frees the values of a filter
+*/
+void free_row_filter(Row_filter *filter);
+
+#endif //STOIDOC_ROWINDEX_H
@@ -0,0 +1,248 @@
+/**
+ *  snapshot.c
+ */
+#include "snapshot.h"
+#include "labelhash.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the first bytes of a snapshot, and the version of its layout          */
+#define SNAPSHOT_MAGIC        "STOIDOCS"
+#define SNAPSHOT_VERSION      1
+
+/* the records start at this boundary                                    */
+#define SNAPSHOT_ALIGN        64
+
+/** the header at the start of a snapshot                                */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t schema_hash;
+    int64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint32_t non_SAP_fields;
+    uint32_t count;
+    uint64_t records_offset;
+    uint64_t segments_offset;
+    uint64_t segment_count;
+    uint64_t pool_offset;
+    uint64_t pool_size;
+} Snapshot_header;
+
+/**
+    hashes the record layout: every schema entry's column, storage kind,
+    offset and size, and the size of a pointer, so a snapshot written by
+    another build is not mapped
+*/
+static uint64_t schema_hash() {
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    size_t pointer_size = sizeof(char *);
+
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        hash = fnv1a(hash, label_fields[f].column, strlen(label_fields[f].column) + 1);
+        hash = fnv1a(hash, &label_fields[f].store, sizeof(label_fields[f].store));
+        hash = fnv1a(hash, &label_fields[f].offset, sizeof(label_fields[f].offset));
+        hash = fnv1a(hash, &label_fields[f].size, sizeof(label_fields[f].size));
+        hash = fnv1a(hash, &label_fields[f].flag, sizeof(label_fields[f].flag));
+    }
+    return fnv1a(hash, &pointer_size, sizeof(pointer_size));
+}
+
+static size_t align(size_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+/**
+    writes n zero bytes, to pad the file to the next section
+*/
+static void pad(FILE *fp, size_t n) {
+    while (n-- > 0)
+        fputc(0, fp);
+}
+
+int save_label_snapshot(const char *name, const char *source, const Label_record *labels, int count) {
+
+    Snapshot_header header = {.version = SNAPSHOT_VERSION, .record_size = sizeof(Label_record)};
+    struct stat st;
+    uint64_t segment_count = 0, pool_size = 0;
+
+    if (stat(source, &st) != 0)
+        return -1;
+
+    for (int i = 1; i < count; i++)
+        for (int seg = 0; seg < labels[i].tdline_count; seg++) {
+            segment_count++;
+            pool_size += strlen(labels[i].tdline_segments[seg]) + 1;
+        }
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.schema_hash = schema_hash();
+    header.source_size = (int64_t) st.st_size;
+    header.source_mtime_sec = (int64_t) st.st_mtim.tv_sec;
+    header.source_mtime_nsec = (int64_t) st.st_mtim.tv_nsec;
+    header.non_SAP_fields = non_SAP_fields;
+    header.count = (uint32_t) count;
+    header.records_offset = align(sizeof(Snapshot_header));
+    header.segments_offset = align(header.records_offset + (uint64_t) count * sizeof(Label_record));
+    header.segment_count = segment_count;
+    header.pool_offset = header.segments_offset + segment_count * sizeof(uint64_t);
+    header.pool_size = pool_size;
+
+    char *tmp = (char *) malloc(strlen(name) + 5);
+    FILE *fp;
+    int rc = 0;
+
+    if (tmp == NULL)
+        return -1;
+    sprintf(tmp, "%s.tmp", name);
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        free(tmp);
+        return -1;
+    }
+
+    fwrite(&header, sizeof(header), 1, fp);
+    pad(fp, header.records_offset - sizeof(header));
+
+    // a record's TDLINE pointers are saved as 1 + the offset of its text in
+    // the pool and 1 + the index of its first segment; 0 stands for NULL
+    uint64_t segment = 0, text = 0;
+    for (int i = 0; i < count; i++) {
+        Label_record record = labels[i];
+
+        record.tdline = (record.tdline_count > 0) ? (char *) (uintptr_t) (text + 1) : NULL;
+        record.tdline_segments = (record.tdline_count > 0) ? (char **) (uintptr_t) (segment + 1) : NULL;
+        for (int seg = 0; seg < labels[i].tdline_count; seg++) {
+            segment++;
+            text += strlen(labels[i].tdline_segments[seg]) + 1;
+        }
+        fwrite(&record, sizeof(record), 1, fp);
+    }
+    pad(fp, header.segments_offset - header.records_offset - (uint64_t) count * sizeof(Label_record));
+
+    text = 0;
+    for (int i = 1; i < count; i++)
+        for (int seg = 0; seg < labels[i].tdline_count; seg++) {
+            fwrite(&text, sizeof(text), 1, fp);
+            text += strlen(labels[i].tdline_segments[seg]) + 1;
+        }
+    for (int i = 1; i < count; i++)
+        for (int seg = 0; seg < labels[i].tdline_count; seg++)
+            fwrite(labels[i].tdline_segments[seg], strlen(labels[i].tdline_segments[seg]) + 1, 1, fp);
+
+    bool failed = ferror(fp) != 0;
+    if ((fclose(fp) != 0) || failed || (rename(tmp, name) != 0)) {
+        remove(tmp);
+        rc = -1;
+    }
+    free(tmp);
+    return rc;
+}
+
+/**
+    checks a snapshot's header against the spreadsheet, the record layout
+    and the file's length
+    @return true if the snapshot can be mapped
+*/
+static bool header_current(const Snapshot_header *header, const struct stat *source, size_t length) {
+
+    if (length < sizeof(Snapshot_header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+        return false;
+    if (header->version != SNAPSHOT_VERSION || header->record_size != sizeof(Label_record) ||
+        header->schema_hash != schema_hash())
+        return false;
+    if (header->source_size != (int64_t) source->st_size ||
+        header->source_mtime_sec != (int64_t) source->st_mtim.tv_sec ||
+        header->source_mtime_nsec != (int64_t) source->st_mtim.tv_nsec)
+        return false;
+
+    // the non-SAP columns are only parsed when a run needs them
+    if (non_SAP_fields && !header->non_SAP_fields)
+        return false;
+
+    return header->count > 0 &&
+           header->records_offset + (uint64_t) header->count * sizeof(Label_record) <= header->segments_offset &&
+           header->segments_offset + header->segment_count * sizeof(uint64_t) == header->pool_offset &&
+           header->pool_offset + header->pool_size == length;
+}
+
+Label_record *load_label_snapshot(const char *name, const char *source, Label_snapshot *snapshot, int *count) {
+
+    struct stat st, source_st;
+    int fd;
+
+    snapshot->base = NULL;
+    if (stat(source, &source_st) != 0 || (fd = open(name, O_RDONLY)) < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    // a private mapping takes the pointer fix-ups without changing the file
+    snapshot->length = (size_t) st.st_size;
+    snapshot->base = mmap(NULL, snapshot->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snapshot->base == MAP_FAILED) {
+        snapshot->base = NULL;
+        return NULL;
+    }
+
+    const Snapshot_header *header = (const Snapshot_header *) snapshot->base;
+    if (!header_current(header, &source_st, snapshot->length)) {
+        close_label_snapshot(snapshot);
+        return NULL;
+    }
+
+    char *base = (char *) snapshot->base;
+    Label_record *labels = (Label_record *) (base + header->records_offset);
+    char **segments = (char **) (base + header->segments_offset);
+    char *pool = base + header->pool_offset;
+
+    // each segment's offset becomes a pointer into the pool, whose text all ends
+    if (header->pool_size > 0 && pool[header->pool_size - 1] != '\0') {
+        close_label_snapshot(snapshot);
+        return NULL;
+    }
+    for (uint64_t seg = 0; seg < header->segment_count; seg++) {
+        uint64_t offset;
+        memcpy(&offset, &segments[seg], sizeof(offset));
+        if (offset >= header->pool_size) {
+            close_label_snapshot(snapshot);
+            return NULL;
+        }
+        segments[seg] = pool + offset;
+    }
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        uint64_t text = (uint64_t) (uintptr_t) labels[i].tdline;
+        uint64_t first = (uint64_t) (uintptr_t) labels[i].tdline_segments;
+
+        if (labels[i].tdline_count < 0 || (labels[i].tdline_count > 0 &&
+            (text == 0 || text > header->pool_size || first == 0 ||
+             first - 1 + (uint64_t) labels[i].tdline_count > header->segment_count))) {
+            close_label_snapshot(snapshot);
+            return NULL;
+        }
+        labels[i].tdline = (labels[i].tdline_count > 0) ? pool + text - 1 : NULL;
+        labels[i].tdline_segments = (labels[i].tdline_count > 0) ? segments + first - 1 : NULL;
+    }
+
+    *count = (int) header->count;
+    return labels;
+}
+
+void close_label_snapshot(Label_snapshot *snapshot) {
+
+    if (snapshot->base != NULL)
+        munmap(snapshot->base, snapshot->length);
+    snapshot->base = NULL;
+}
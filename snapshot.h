@@ -0,0 +1,53 @@
+/**
+    @file snapshot.h
+    Together with snapshot.c, this component saves a spreadsheet's parsed
+    and sorted label records to a binary snapshot file, and maps them back
+    in later runs, which then skip reading, parsing and sorting. The file
+    holds a versioned header, the Label_record array as it is in memory, a
+    table of TDLINE segments and a pool of their text. The records' TDLINE
+    pointers are saved as offsets and fixed up in the private mapping. A
+    snapshot is used only while the spreadsheet's size and modification
+    time, the record layout and the parse options match its header.
+*/
+
+#ifndef STOIDOC_SNAPSHOT_H
+#define STOIDOC_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "label.h"
+
+/** a mapped snapshot                                                    */
+typedef struct {
+    void *base;
+    size_t length;
+} Label_snapshot;
+
+/**
+    saves label records to a snapshot, first to a temporary file that is
+    then renamed, so that a concurrent run never maps half of one
+    @param name is the snapshot file
+    @param source is the spreadsheet the records were parsed from
+    @param labels is the sorted label records, from labels[1]
+    @param count is the number of records, labels[0] included
+    @return 0 if successful, -1 if unsuccessful
+*/
+int save_label_snapshot(const char *name, const char *source, const Label_record *labels, int count);
+
+/**
+    maps the label records of a snapshot, unless it is out of date: made
+    from another version of the spreadsheet, by another version of idoc or
+    without the non-SAP columns a run needs
+    @param name is the snapshot file
+    @param source is the spreadsheet to convert
+    @param snapshot receives the mapping
+    @param count receives the number of records, labels[0] included
+    @return the label records, or NULL if the snapshot is missing, out of
+    date or unreadable
+*/
+Label_record *load_label_snapshot(const char *name, const char *source, Label_snapshot *snapshot, int *count);
+
+void close_label_snapshot(Label_snapshot *snapshot);
+
+#endif //STOIDOC_SNAPSHOT_H
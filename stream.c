@@ -0,0 +1,260 @@
+/**
+ *  stream.c
+ */
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+extern char **environ;
+
+/* leading bytes identifying a gzip and a zstd file                      */
+static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+/**
+    writes all n bytes of buf to a file descriptor, retrying short writes
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(fd, buf, n);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        n -= (size_t) written;
+    }
+    return 0;
+}
+
+/**
+    thread body that decompresses a gzip file into the write end of a pipe
+*/
+static void *gunzip_pump(void *arg) {
+    Stream *s = (Stream *) arg;
+    char buffer[STREAM_BUF_SIZE];
+    int n;
+
+    while ((n = gzread((gzFile) s->gz, buffer, sizeof(buffer))) > 0)
+        if (write_all(s->fd, buffer, (size_t) n) != 0)
+            break;
+    if (n < 0)
+        s->error = true;
+
+    close(s->fd);
+    return NULL;
+}
+
+/**
+    thread body that compresses everything read from a pipe into a gzip file
+*/
+static void *gzip_pump(void *arg) {
+    Stream *s = (Stream *) arg;
+    char buffer[STREAM_BUF_SIZE];
+    ssize_t n;
+
+    // keep draining the pipe after an error so the emitter never blocks
+    while ((n = read(s->fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            s->error = true;
+            break;
+        }
+        if (!s->error && gzwrite((gzFile) s->gz, buffer, (unsigned) n) != n)
+            s->error = true;
+    }
+
+    close(s->fd);
+    return NULL;
+}
+
+/**
+    starts "zstd -dc" with its standard input reading from fd and its
+    standard output writing into the pipe
+    @return 0 if successful, -1 if unsuccessful
+*/
+static int spawn_unzstd(Stream *s, int fd, int pipe_write) {
+    char *args[] = {"zstd", "-dcq", NULL};
+    posix_spawn_file_actions_t actions;
+    int rc;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipe_write, STDOUT_FILENO);
+    rc = posix_spawnp(&s->child, "zstd", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (rc != 0) {
+        printf("Could not start \"zstd\" to decompress the spreadsheet: %s\n", strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+int stream_open_input(Stream *s, const char *filename) {
+
+    unsigned char magic[4] = {0};
+    int pipe_fds[2];
+    int fd;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return -1;
+
+    ssize_t n = read(fd, magic, sizeof(magic));
+    if (n >= 2 && memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0)
+        s->kind = STREAM_GZIP;
+    else if (n >= 4 && memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0)
+        s->kind = STREAM_ZSTD;
+    else
+        s->kind = STREAM_PLAIN;
+
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (s->kind == STREAM_PLAIN) {
+        if ((s->fp = fdopen(fd, "r")) == NULL) {
+            close(fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    // a reader that stops early must not kill the process with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pipe(pipe_fds) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (s->kind == STREAM_GZIP) {
+        if ((s->gz = gzdopen(fd, "rb")) == NULL) {
+            close(fd);
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            return -1;
+        }
+        gzbuffer((gzFile) s->gz, STREAM_BUF_SIZE);
+        s->fd = pipe_fds[1];
+        if (pthread_create(&s->pump, NULL, gunzip_pump, s) != 0) {
+            gzclose((gzFile) s->gz);
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            return -1;
+        }
+    } else {
+        int rc = spawn_unzstd(s, fd, pipe_fds[1]);
+        close(fd);
+        close(pipe_fds[1]);
+        if (rc != 0) {
+            close(pipe_fds[0]);
+            return -1;
+        }
+    }
+
+    if ((s->fp = fdopen(pipe_fds[0], "r")) == NULL) {
+        close(pipe_fds[0]);
+        stream_close(s);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_open_output(Stream *s, const char *filename, bool compress) {
+
+    int pipe_fds[2];
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->output = true;
+    s->kind = compress ? STREAM_GZIP : STREAM_PLAIN;
+
+    if (!compress)
+        return (s->fp = fopen(filename, "w")) == NULL ? -1 : 0;
+
+    if ((s->gz = gzopen(filename, "wb")) == NULL)
+        return -1;
+    gzbuffer((gzFile) s->gz, STREAM_BUF_SIZE);
+
+    if (pipe(pipe_fds) != 0) {
+        gzclose((gzFile) s->gz);
+        return -1;
+    }
+
+    s->fd = pipe_fds[0];
+    if (pthread_create(&s->pump, NULL, gzip_pump, s) != 0) {
+        gzclose((gzFile) s->gz);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+
+    if ((s->fp = fdopen(pipe_fds[1], "w")) == NULL) {
+        close(pipe_fds[1]);
+        stream_close(s);
+        return -1;
+    }
+    setvbuf(s->fp, NULL, _IOFBF, STREAM_BUF_SIZE);
+    return 0;
+}
+
+int stream_reopen_output(Stream *s, const char *filename, long length) {
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->output = true;
+    s->kind = STREAM_PLAIN;
+
+    if ((s->fp = fopen(filename, "r+")) == NULL)
+        return -1;
+
+    // the part after length was written after the last checkpoint
+    if ((fseek(s->fp, 0, SEEK_END) != 0) || (ftell(s->fp) < length) ||
+        (ftruncate(fileno(s->fp), (off_t) length) != 0) || (fseek(s->fp, length, SEEK_SET) != 0)) {
+        fclose(s->fp);
+        s->fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int stream_close(Stream *s) {
+
+    int rc = 0;
+
+    // closing our end of the pipe lets the pump thread or process finish
+    if (s->fp != NULL && fclose(s->fp) != 0)
+        rc = -1;
+    s->fp = NULL;
+
+    if (s->kind == STREAM_GZIP) {
+        pthread_join(s->pump, NULL);
+        if (gzclose((gzFile) s->gz) != Z_OK)
+            rc = -1;
+    } else if (s->kind == STREAM_ZSTD && s->child > 0) {
+        int status = 0;
+        while (waitpid(s->child, &status, 0) < 0 && errno == EINTR);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            rc = -1;
+    }
+
+    if (s->error)
+        rc = -1;
+    return rc;
+}
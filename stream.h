@@ -0,0 +1,84 @@
+/**
+    @file stream.h
+    Together with stream.c, this component opens the spreadsheet for reading
+    and the IDoc for writing. gzip- and zstd-compressed spreadsheets are
+    decompressed on the fly, and the IDoc can be gzip-compressed as it is
+    written. In both cases a helper thread (or, for zstd, a helper process)
+    pumps the data through a pipe, so the reader and emitter keep working on
+    an ordinary FILE pointer.
+*/
+
+#ifndef STOIDOC_STREAM_H
+#define STOIDOC_STREAM_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* extension appended to the output file name when compressing           */
+#define GZ_EXT                ".gz"
+
+/* size of the buffers used to move data between the pipe and zlib        */
+#define STREAM_BUF_SIZE       65536
+
+typedef enum {
+    STREAM_PLAIN,
+    STREAM_GZIP,
+    STREAM_ZSTD
+} Stream_kind;
+
+/**
+    an open input or output stream. Only fp is meant to be used by callers;
+    the remaining members belong to stream.c.
+*/
+typedef struct {
+    FILE *fp;
+    Stream_kind kind;
+    bool output;
+
+    void *gz;
+    int fd;
+    pthread_t pump;
+    pid_t child;
+    bool error;
+} Stream;
+
+/**
+    opens a spreadsheet for reading. The file's leading bytes determine
+    whether it is plain text, gzip or zstd compressed; compressed files are
+    decompressed while they are read.
+    @param s is the stream to initialize
+    @param filename is the file to open
+    @return 0 if successful, -1 if unsuccessful
+*/
+int stream_open_input(Stream *s, const char *filename);
+
+/**
+    opens an IDoc for writing.
+    @param s is the stream to initialize
+    @param filename is the file to create
+    @param compress if true, the IDoc is gzip-compressed as it is written
+    @return 0 if successful, -1 if unsuccessful
+*/
+int stream_open_output(Stream *s, const char *filename, bool compress);
+
+/**
+    reopens a partly written, uncompressed IDoc to continue writing it. The
+    file is cut back to the given length and written from there on.
+    @param s is the stream to initialize
+    @param filename is the file to reopen
+    @param length is the length to keep
+    @return 0 if successful, -1 if the file is missing, shorter than length
+    or cannot be cut back
+*/
+int stream_reopen_output(Stream *s, const char *filename, long length);
+
+/**
+    closes a stream, waiting for any decompression or compression to finish.
+    @param s is the stream to close
+    @return 0 if all data was transferred successfully, -1 otherwise
+*/
+int stream_close(Stream *s);
+
+#endif //STOIDOC_STREAM_H
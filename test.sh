@@ -1,22 +1,237 @@
 #!/bin/bash
 FAIL=0
 
+cd "$(dirname "$0")" || exit 1
+ROOT=$(pwd)
+
 # Function to run the program against a test case and check
 # its output and exit status for correct behavior
 
-echo "Test input.txt"
-./idoc input.txt
-echo "Test input2.txt"
-./idoc input2.txt
-echo "Test input3.txt"
-./idoc input3.txt
-echo "Test input4.txt"
-./idoc input4.txt
-echo "Test input5.txt"
-./idoc input5.txt
-echo "Test input6.txt"
-./idoc input6.txt
-echo "Test DCO-031973.txt"
-./idoc DCO-031973.txt
-echo "Test DCO-034213.txt"
-./idoc DCO-034213.txt
\ No newline at end of file
+# the sample spreadsheets are converted when they are present
+for input in input.txt input2.txt input3.txt input4.txt input5.txt input6.txt DCO-031973.txt DCO-034213.txt; do
+    if [ -f "$input" ]; then
+        echo "Test $input"
+        ./idoc "$input"
+    fi
+done
+
+# the checked cases run on copies of the spreadsheets in tests/, in a
+# scratch folder, and compare their output with tests/expected/
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cp "$ROOT"/tests/*.txt "$WORK"
+
+# compares an output file with its expected contents
+check() {
+    if diff -u "$ROOT/tests/expected/$1" "$2" > "$WORK/diff.out"; then
+        echo "PASS $1"
+    else
+        echo "FAIL $1"
+        cat "$WORK/diff.out"
+        FAIL=1
+    fi
+}
+
+# runs a program in the scratch folder and checks its exit status; its
+# output, without the timing line, is left in $WORK/run.log
+run() {
+    local status=$1
+    shift
+    (cd "$WORK" && "$@") 2>&1 | grep -v "Time elapsed" > "$WORK/run.log"
+    local actual=${PIPESTATUS[0]}
+    if [ "$actual" != "$status" ]; then
+        echo "FAIL $* exited with $actual instead of $status"
+        FAIL=1
+    fi
+}
+
+# lists the IDoc files of labels.txt, each with its control numbers and labels
+summary() {
+    for idoc in "$WORK"/labels_IDoc*.txt; do
+        echo "${idoc##*/}: $(grep '^Z2BTLH01' "$idoc" | cut -c43-49 | sort -u | tr '\n' ' ')-" \
+             "$(grep '^Z2BTLH01' "$idoc" | cut -c64- | tr -d ' ' | tr '\n' ' ')"
+    done > "$WORK/$1"
+}
+
+# copies an IDoc with the timestamp of its control record masked
+idoc_text() {
+    sed -E '1s/BARTENDER( +)[0-9]{14}/BARTENDER\1TIMESTAMP/' "$WORK/$1" > "$WORK/$2"
+}
+
+echo "Test repeated label rows"
+run 0 "$ROOT/idoc" dup.txt
+check dup.log "$WORK/run.log"
+idoc_text "dup_IDoc (stoidoc).txt" dup.idoc
+check dup.idoc "$WORK/dup.idoc"
+
+echo "Test --check of repeated label rows"
+run 1 "$ROOT/idoc" dup.txt --check
+check dup_check.txt "$WORK/dup_check.txt"
+
+echo "Test --check of a spreadsheet with no REVISION column"
+run 0 "$ROOT/idoc" norev.txt --check
+check norev_check.txt "$WORK/norev_check.txt"
+
+echo "Test -I and --extract"
+run 0 "$ROOT/idoc" labels.txt -I
+check labels.idx "$WORK/labels_IDoc (stoidoc).txt.idx"
+run 0 "$ROOT/idoc" --extract "labels_IDoc (stoidoc).txt" LBL1004 LBL1002
+check extract.txt "$WORK/run.log"
+
+# the index counts the same bytes whether the IDoc is compressed or written in parallel
+for opt in -z -P; do
+    echo "Test -I $opt"
+    run 0 "$ROOT/idoc" labels.txt -I $opt
+    idx="$WORK/labels_IDoc (stoidoc).txt.idx"
+    [ "$opt" = -z ] && idx="$WORK/labels_IDoc (stoidoc).txt.gz.idx"
+    check labels.idx "$idx"
+done
+
+# a checkpoint after label LBL1004, with the IDoc cut off part way into LBL1005;
+# the control number is 2541435 unless a third argument gives another
+checkpoint() {
+    local idoc="$WORK/labels_IDoc (stoidoc).txt"
+    head -c "$1" "$WORK/labels.full" > "$idoc"
+    printf '4 LBL1004 9122 %s 16 17 24 24 30 %s\n20002\n' "${3:-2541435}" "$2" > "$idoc.ckpt"
+}
+
+echo "Test --resume"
+run 0 "$ROOT/idoc" labels.txt
+idoc_text "labels_IDoc (stoidoc).txt" labels.idoc
+check labels.idoc "$WORK/labels.idoc"
+cp "$WORK/labels_IDoc (stoidoc).txt" "$WORK/labels.full"
+checkpoint 9500 "0 0"
+run 0 "$ROOT/idoc" labels.txt --resume
+check resume.log "$WORK/run.log"
+idoc_text "labels_IDoc (stoidoc).txt" labels.idoc
+check labels.idoc "$WORK/labels.idoc"
+
+# a checkpoint of other options, or past the end of the IDoc, is not resumed
+for ckpt in "9500 1 0" "9500 0 1" "9000 0 0"; do
+    echo "Test --resume with checkpoint $ckpt"
+    checkpoint ${ckpt%% *} "${ckpt#* }"
+    run 0 "$ROOT/idoc" labels.txt --resume
+    check resume_rejected.log "$WORK/run.log"
+done
+
+# with -C, a resumed IDoc keeps its control number and reserves none
+echo "Test --resume with -C"
+echo 0000100 > "$WORK/idoc.counter"
+run 0 "$ROOT/idoc" labels.txt -C idoc.counter
+idoc_text "labels_IDoc (stoidoc).txt" labels_ctrl.idoc
+check labels_ctrl.idoc "$WORK/labels_ctrl.idoc"
+cp "$WORK/labels_IDoc (stoidoc).txt" "$WORK/labels.full"
+checkpoint 9500 "0 0" 0000101
+run 0 "$ROOT/idoc" labels.txt --resume -C idoc.counter
+check resume.log "$WORK/run.log"
+idoc_text "labels_IDoc (stoidoc).txt" labels_ctrl.idoc
+check labels_ctrl.idoc "$WORK/labels_ctrl.idoc"
+check counter_101.txt "$WORK/idoc.counter"
+
+# a checkpoint that does not fit is written from the start with a new number
+checkpoint 9500 "1 0" 0000101
+run 0 "$ROOT/idoc" labels.txt --resume -C idoc.counter
+check resume_rejected.log "$WORK/run.log"
+check counter_102.txt "$WORK/idoc.counter"
+
+echo "Test idocdiff"
+run 0 "$ROOT/idoc" labels.txt
+cp "$WORK/labels_IDoc (stoidoc).txt" "$WORK/labels.old"
+run 0 "$ROOT/idoc" labels_new.txt
+run 1 "$ROOT/idocdiff" labels.old "labels_new_IDoc (stoidoc).txt"
+check idocdiff.txt "$WORK/run.log"
+
+echo "Test idoc2txt"
+run 0 "$ROOT/idoc2txt" labels.old labels_back.txt
+check idoc2txt.log "$WORK/run.log"
+check labels_back.txt "$WORK/labels_back.txt"
+
+echo "Test --delta"
+run 0 "$ROOT/idoc" --delta labels.txt labels_new.txt
+check delta.log "$WORK/run.log"
+check labels_new_deleted.txt "$WORK/labels_new_deleted.txt"
+idoc_text "labels_new_IDoc (stoidoc --delta).txt" delta.idoc
+check delta.idoc "$WORK/delta.idoc"
+
+# a label repeated in the base is compared with its first row, or is changed if its rows differ
+echo "Test --delta with repeated base rows"
+run 0 "$ROOT/idoc" --delta labels_dup.txt labels.txt
+check delta_dup.log "$WORK/run.log"
+idoc_text "labels_IDoc (stoidoc --delta).txt" delta_dup.idoc
+check delta_dup.idoc "$WORK/delta_dup.idoc"
+
+# a snapshot is mapped only while its spreadsheet is unchanged
+echo "Test --save-snapshot and --load-snapshot"
+run 0 "$ROOT/idoc" labels.txt --save-snapshot labels.snap
+check snapshot_save.log "$WORK/run.log"
+run 0 "$ROOT/idoc" labels.txt --load-snapshot labels.snap
+check snapshot_load.log "$WORK/run.log"
+idoc_text "labels_IDoc (stoidoc).txt" labels.idoc
+check labels.idoc "$WORK/labels.idoc"
+touch -d "+1 minute" "$WORK/labels.txt"
+run 0 "$ROOT/idoc" labels.txt --load-snapshot labels.snap
+check snapshot_stale.log "$WORK/run.log"
+
+# the -n variant prints the non-SAP DESCRIPTION and IPN columns the others ignore
+echo "Test -V"
+run 0 "$ROOT/idoc" variants.txt -V std,n,J
+check variants.log "$WORK/run.log"
+for v in "" " -n" " -J"; do
+    idoc_text "variants_IDoc (stoidoc$v).txt" "variants${v# }.idoc"
+    check "variants${v# }.idoc" "$WORK/variants${v# }.idoc"
+done
+
+# a material group is never split: with -L 1 each two-label group is a shard of its own
+for opt in "-L 1" "-B 9000" "-M"; do
+    echo "Test $opt"
+    rm -f "$WORK"/labels_IDoc*
+    run 0 "$ROOT/idoc" labels.txt $opt
+    summary shards.txt
+    check "shards${opt// /}.txt" "$WORK/shards.txt"
+done
+
+# every shard is a complete IDoc, with sequence numbers starting over
+idoc_text "labels_IDoc (stoidoc)_002.txt" shard_002.idoc
+check shard_002.idoc "$WORK/shard_002.idoc"
+
+# each run reserves one control number per IDoc file; later runs continue the count
+echo "Test -C across runs"
+echo 0000100 > "$WORK/idoc.counter"
+for n in 1 2; do
+    rm -f "$WORK"/labels_IDoc*
+    run 0 "$ROOT/idoc" labels.txt -M -C idoc.counter
+    summary "counter_run$n.txt"
+    check "counter_run$n.txt" "$WORK/counter_run$n.txt"
+done
+check counter_106.txt "$WORK/idoc.counter"
+
+# the first filtered run indexes the spreadsheet's rows, and the next ones read the index
+filter_test() {
+    local name=$1
+    shift
+    echo "Test $*"
+    rm -f "$WORK"/labels_IDoc*
+    run 0 "$ROOT/idoc" labels.txt "$@"
+    check "$name.log" "$WORK/run.log"
+    summary "$name.txt"
+    check "$name.txt" "$WORK/$name.txt"
+}
+filter_test filter_labels --labels LBL1005,LBL1002
+idoc_text "labels_IDoc (stoidoc).txt" filter_labels.idoc
+check filter_labels.idoc "$WORK/filter_labels.idoc"
+filter_test filter_range --label-range LBL1002 LBL1004
+filter_test filter_both --material 20002,20003 --labels LBL1004,LBL1005,LBL1001
+
+# a spreadsheet that changed has its row index rebuilt
+printf 'LBL1006\t20002\tTPL02\tR1\tSterile\tN\tLogoB\t\n' >> "$WORK/labels.txt"
+filter_test filter_rebuilt --material 20002
+cp "$ROOT/tests/labels.txt" "$WORK"
+
+# two spreadsheets with their columns in different orders give the IDoc of the one they split
+echo "Test merging several spreadsheets"
+run 0 "$ROOT/idoc" part1.txt part2.txt
+check merge.log "$WORK/run.log"
+idoc_text "part1_IDoc (stoidoc).txt" labels.idoc
+check labels.idoc "$WORK/labels.idoc"
+
+exit $FAIL